@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "descriptor_set.h"
+
+#define SET_ALIGN 64
+
+// Descriptors harris_corner_detector extracts.
+static DESCRIPTOR descriptor_type = DESCRIPTOR_PATCH;
+
+// Layout of the single allocation: view[n], points[n], and the rows of
+// values starting on the next aligned boundary. Offsets below are from the
+// start of view.
+static size_t header_bytes(int n)
+{
+    size_t bytes = (size_t)n*(sizeof(descriptor) + sizeof(point));
+    return (bytes + SET_ALIGN - 1) / SET_ALIGN * SET_ALIGN;
+}
+
+static int row_stride(int dim)
+{
+    return (dim + L1_LANES - 1) / L1_LANES * L1_LANES;
+}
+
+// Choose the descriptors harris_corner_detector extracts, for every later
+// call. Matching follows whatever the descriptors are.
+void set_descriptor_type(DESCRIPTOR kind)
+{
+    descriptor_type = kind;
+}
+
+DESCRIPTOR get_descriptor_type()
+{
+    return descriptor_type;
+}
+
+// Allocate a set of zeroed descriptors with a view over them.
+// int n: number of descriptors.
+// int dim: values in each descriptor, BRIEF_WORDS for DESCRIPTOR_BRIEF.
+// DESCRIPTOR kind: what the values will be.
+// returns: the set, points all (0, 0).
+descriptor_set make_descriptor_set(int n, int dim, DESCRIPTOR kind)
+{
+    descriptor_set s;
+    s.kind = kind;
+    s.n = n;
+    s.dim = dim;
+    s.stride = row_stride(dim);
+    size_t head = header_bytes(n);
+    // An empty set still gets a block, for free_descriptors(view, 0).
+    size_t bytes = head + (size_t)n*s.stride*sizeof(float);
+    bytes = MAX((bytes + SET_ALIGN - 1) / SET_ALIGN * SET_ALIGN, SET_ALIGN);
+    char *block = aligned_alloc(SET_ALIGN, bytes);
+    memset(block, 0, bytes);
+    s.view = (descriptor *)block;
+    s.points = (point *)(s.view + n);
+    s.vals = (float *)(block + head);
+    int i;
+    for(i = 0; i < n; ++i){
+        s.view[i].n = dim;
+        s.view[i].kind = kind;
+        s.view[i].shared = i ? 2 : 1;
+        s.view[i].data = s.vals + (size_t)i*s.stride;
+    }
+    return s;
+}
+
+void free_descriptor_set(descriptor_set s)
+{
+    free(s.view);
+}
+
+// Recover the set behind an array of descriptors, if it is a set's view.
+// The first descriptor of a view is marked as the start of the set, and
+// every one carries its kind, so nothing outside the array is read. An
+// empty array is no set.
+// descriptor *d: array of descriptors.
+// int n: number of descriptors, all of those in the set.
+// descriptor_set *s: filled in if d is a view.
+// returns: 1 if d is the view of a descriptor set, 0 otherwise.
+int descriptor_set_of(descriptor *d, int n, descriptor_set *s)
+{
+    if(n <= 0 || d[0].shared != 1) return 0;
+    s->kind = d[0].kind;
+    s->n = n;
+    s->dim = d[0].n;
+    s->stride = row_stride(d[0].n);
+    s->vals = d[0].data;
+    s->points = (point *)(d + n);
+    s->view = d;
+    return 1;
+}
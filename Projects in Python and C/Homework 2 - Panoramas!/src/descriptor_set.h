@@ -0,0 +1,56 @@
+#ifndef DESCRIPTOR_SET_H
+#define DESCRIPTOR_SET_H
+#include "image.h"
+#include "match_index.h"
+
+// Bits in a binary descriptor, and the 32 bit words they are packed into.
+// The words are stored in the float slots of a descriptor.
+#define BRIEF_BITS 256
+#define BRIEF_WORDS (BRIEF_BITS/32)
+// Comparisons reach at most this far from the corner, on an image smoothed
+// with this std. dev.
+#define BRIEF_RADIUS 15
+#define BRIEF_SIGMA 2
+
+// What the values of a descriptor are.
+// DESCRIPTOR_PATCH: 5x5xc differences from the centre pixel, compared by
+//                   L1 distance.
+// DESCRIPTOR_BRIEF: BRIEF_BITS intensity comparisons on the smoothed image,
+//                   BRIEF_WORDS words compared by Hamming distance.
+typedef enum{DESCRIPTOR_PATCH, DESCRIPTOR_BRIEF} DESCRIPTOR;
+
+// Descriptors stored in one allocation instead of one per corner.
+// DESCRIPTOR kind: what the values are.
+// int n, dim: number of descriptors and values in each.
+// int stride: floats between rows of vals, dim rounded up to L1_LANES.
+// float *vals: the descriptors, one zero padded row each, 64 byte aligned.
+// point *points: where each descriptor was taken.
+// descriptor *view: the same descriptors for the descriptor* API, with data
+//                   pointing into vals. Starts the allocation, with its
+//                   first descriptor marked as the start, so a view can
+//                   be released with free_descriptors(view, n) even when
+//                   n is 0.
+typedef struct{
+    DESCRIPTOR kind;
+    int n, dim;
+    int stride;
+    float *vals;
+    point *points;
+    descriptor *view;
+} descriptor_set;
+
+void set_descriptor_type(DESCRIPTOR kind);
+DESCRIPTOR get_descriptor_type();
+
+descriptor_set make_descriptor_set(int n, int dim, DESCRIPTOR kind);
+void free_descriptor_set(descriptor_set s);
+int descriptor_set_of(descriptor *d, int n, descriptor_set *s);
+
+image harris_response(image im, float sigma);
+image nms_image(image im, int w);
+int *nms_corners(image im, int w, float thresh, int *n);
+descriptor describe_index(image im, int i);
+void describe_points(image im, descriptor_set s);
+descriptor_set harris_descriptor_set(image im, float sigma, float thresh, int nms, DESCRIPTOR kind);
+
+#endif
@@ -4,6 +4,7 @@
 #include <math.h>
 #include <assert.h>
 #include "image.h"
+#include "padded_image.h"
 #define TWOPI 6.2831853
 
 #define FOREACH_PIXEL(W, H, FUNC) \
@@ -45,20 +46,13 @@ image convolve_image(image im, image filter, int preserve)
 {
     // TODO
     assert(im.c == filter.c || filter.c == 1);
-    image new_img = make_image(im.w, im.h, preserve ? im.c : 1);
     assert(filter.w % 2);
-    int center_x = filter.w / 2, center_y = filter.h / 2;
-    for (int c = 0; c < im.c; ++c) {
-        FOREACH_PIXEL(new_img.w, new_img.h, {
-            int cur_i = i;
-            int cur_j = j;
-            float q = preserve ? 0 : get_pixel(new_img, cur_i, cur_j, 0);
-            FOREACH_PIXEL(filter.w, filter.h, 
-                q += get_pixel(im, cur_i - (center_x - i), cur_j - (center_y - j), c) * get_pixel(filter, i, j, filter.c == 1 ? 0 : c);
-            );
-            set_pixel(new_img, cur_i, cur_j, preserve ? c : 0, q);
-        });
-    }
+    // Pad once with a clamped halo so the inner loop never clamps.
+    padded_image p = pad_image(im, MAX(filter.w, filter.h) / 2, BORDER_CLAMP);
+    padded_image r = padded_convolve(&p, filter, preserve);
+    image new_img = unpad_image(r);
+    free_padded_image(p);
+    free_padded_image(r);
     return new_img;
 }
 
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "image.h"
+#include "gaussian_image.h"
+
+#define SQUARE(X) ((X) * (X))
+
+// Width of the columns handled together by the recursive vertical pass.
+#define RECURSIVE_BAND 256
+
+// Creates a normalized 1d Gaussian filter.
+// float sigma: standard deviation of Gaussian.
+// returns: single row image of the filter, summing to 1.
+image make_1d_gaussian(float sigma)
+{
+    int w = (int)ceil(6 * sigma);
+    w = w & 1 ? w : w + 1;
+    int center = w / 2;
+    image img = make_image(w, 1, 1);
+    float sum = 0;
+    int i;
+    for(i = 0; i < w; ++i){
+        img.data[i] = exp(-SQUARE(i - center) / (2 * SQUARE(sigma)));
+        sum += img.data[i];
+    }
+    for(i = 0; i < w; ++i){
+        img.data[i] /= sum;
+    }
+    return img;
+}
+
+// Exact Gaussian blur as a row pass followed by a column pass.
+// Borders are clamped, like get_pixel, so the result matches a 2d
+// convolution with the outer product of the kernel.
+// image im: image to blur.
+// float sigma: std dev. for Gaussian.
+// returns: blurred image.
+static image separable_blur(image im, float sigma)
+{
+    image g = make_1d_gaussian(sigma);
+    int r = g.w / 2;
+    int n;
+    image tmp = make_image(im.w, im.h, im.c);
+    image out = make_image(im.w, im.h, im.c);
+
+    #pragma omp parallel
+    {
+        float *row = calloc(im.w + 2*r, sizeof(float));
+        int i, k;
+        #pragma omp for
+        for(n = 0; n < im.c*im.h; ++n){
+            const float *src = im.data + n*im.w;
+            float *dst = tmp.data + n*im.w;
+            for(i = 0; i < r; ++i){
+                row[i] = src[0];
+                row[r + im.w + i] = src[im.w - 1];
+            }
+            memcpy(row + r, src, im.w*sizeof(float));
+            for(i = 0; i < im.w; ++i){
+                float sum = 0;
+                for(k = 0; k < g.w; ++k) sum += g.data[k]*row[i + k];
+                dst[i] = sum;
+            }
+        }
+        free(row);
+    }
+
+    #pragma omp parallel for
+    for(n = 0; n < im.c*im.h; ++n){
+        int c = n / im.h, y = n % im.h;
+        const float *plane = tmp.data + c*im.w*im.h;
+        float *dst = out.data + n*im.w;
+        int i, k;
+        for(k = 0; k < g.w; ++k){
+            int yy = MIN(MAX(y + k - r, 0), im.h - 1);
+            const float *src = plane + yy*im.w;
+            float wk = g.data[k];
+            for(i = 0; i < im.w; ++i) dst[i] += wk*src[i];
+        }
+    }
+
+    free_image(tmp);
+    free_image(g);
+    return out;
+}
+
+// Coefficients of the Young - van Vliet recursive Gaussian.
+// float sigma: std dev., at least .5.
+// float *B: gain applied to the input sample.
+// float *b: feedback weights b1/b0, b2/b0, b3/b0.
+static void recursive_coefficients(float sigma, float *B, float *b)
+{
+    double q = sigma >= 2.5 ? .98711*sigma - .96330
+                            : 3.97156 - 4.14554*sqrt(1 - .26891*sigma);
+    double q2 = q*q, q3 = q2*q;
+    double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + .422205*q3;
+    double b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+    double b2 = -(1.4281*q2 + 1.26661*q3);
+    double b3 = .422205*q3;
+    b[0] = b1/b0;
+    b[1] = b2/b0;
+    b[2] = b3/b0;
+    *B = 1 - (b1 + b2 + b3)/b0;
+}
+
+// Causal then anti-causal recursion over one row, in place.
+// The filter has unit DC gain so a clamped border is a fixed point:
+// samples before the start (after the end) equal the first (last) output.
+static void recursive_row(float *d, int n, float B, const float *b)
+{
+    int i;
+    for(i = 0; i < n && i < 3; ++i){
+        d[i] = B*d[i] + b[0]*d[MAX(i-1, 0)] + b[1]*d[MAX(i-2, 0)] + b[2]*d[MAX(i-3, 0)];
+    }
+    for(; i < n; ++i){
+        d[i] = B*d[i] + b[0]*d[i-1] + b[1]*d[i-2] + b[2]*d[i-3];
+    }
+    for(i = n-1; i >= 0 && i >= n-3; --i){
+        d[i] = B*d[i] + b[0]*d[MIN(i+1, n-1)] + b[1]*d[MIN(i+2, n-1)] + b[2]*d[MIN(i+3, n-1)];
+    }
+    for(; i >= 0; --i){
+        d[i] = B*d[i] + b[0]*d[i+1] + b[1]*d[i+2] + b[2]*d[i+3];
+    }
+}
+
+// Same recursion down a band of columns, one whole row at a time so the
+// inner loop runs along contiguous memory.
+static void recursive_columns(float *plane, int stride, int w, int h, float B, const float *b)
+{
+    int y, i;
+    for(y = 0; y < h; ++y){
+        float *d = plane + y*stride;
+        const float *p1 = plane + MAX(y-1, 0)*stride;
+        const float *p2 = plane + MAX(y-2, 0)*stride;
+        const float *p3 = plane + MAX(y-3, 0)*stride;
+        for(i = 0; i < w; ++i) d[i] = B*d[i] + b[0]*p1[i] + b[1]*p2[i] + b[2]*p3[i];
+    }
+    for(y = h-1; y >= 0; --y){
+        float *d = plane + y*stride;
+        const float *p1 = plane + MIN(y+1, h-1)*stride;
+        const float *p2 = plane + MIN(y+2, h-1)*stride;
+        const float *p3 = plane + MIN(y+3, h-1)*stride;
+        for(i = 0; i < w; ++i) d[i] = B*d[i] + b[0]*p1[i] + b[1]*p2[i] + b[2]*p3[i];
+    }
+}
+
+// Approximate Gaussian blur with a 3rd order recursive filter.
+// Costs the same handful of operations per pixel for any sigma.
+// image im: image to blur.
+// float sigma: std dev. for Gaussian, at least .5.
+// returns: blurred image.
+static image recursive_blur(image im, float sigma)
+{
+    float B, b[3];
+    recursive_coefficients(sigma, &B, b);
+    image out = copy_image(im);
+    int bands = (im.w + RECURSIVE_BAND - 1) / RECURSIVE_BAND;
+    int n;
+
+    #pragma omp parallel for
+    for(n = 0; n < im.c*im.h; ++n){
+        recursive_row(out.data + n*im.w, im.w, B, b);
+    }
+
+    #pragma omp parallel for
+    for(n = 0; n < im.c*bands; ++n){
+        int c = n / bands;
+        int x = (n % bands) * RECURSIVE_BAND;
+        recursive_columns(out.data + c*im.w*im.h + x, im.w, MIN(RECURSIVE_BAND, im.w - x), im.h, B, b);
+    }
+    return out;
+}
+
+// Smooth every channel of an image with a Gaussian.
+// image im: image to smooth.
+// float sigma: std dev. for Gaussian.
+// GAUSSIAN_MODE mode: GAUSSIAN_SEPARABLE for the exact kernel,
+//                     GAUSSIAN_RECURSIVE for the constant time filter,
+//                     GAUSSIAN_AUTO to choose by sigma.
+// returns: smoothed image.
+image gaussian_blur(image im, float sigma, GAUSSIAN_MODE mode)
+{
+    if(mode == GAUSSIAN_AUTO){
+        mode = sigma > GAUSSIAN_RECURSIVE_SIGMA ? GAUSSIAN_RECURSIVE : GAUSSIAN_SEPARABLE;
+    }
+    // The recursive coefficients are only fit down to sigma = .5.
+    if(mode == GAUSSIAN_RECURSIVE && sigma >= .5) return recursive_blur(im, sigma);
+    return separable_blur(im, sigma);
+}
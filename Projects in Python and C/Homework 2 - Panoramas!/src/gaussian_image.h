@@ -0,0 +1,14 @@
+#ifndef GAUSSIAN_IMAGE_H
+#define GAUSSIAN_IMAGE_H
+#include "image.h"
+
+// Above this sigma GAUSSIAN_AUTO switches from the exact separable kernel
+// to the recursive filter, whose cost does not depend on sigma.
+#define GAUSSIAN_RECURSIVE_SIGMA 4.0
+
+typedef enum{GAUSSIAN_AUTO, GAUSSIAN_SEPARABLE, GAUSSIAN_RECURSIVE} GAUSSIAN_MODE;
+
+image make_1d_gaussian(float sigma);
+image gaussian_blur(image im, float sigma, GAUSSIAN_MODE mode);
+
+#endif
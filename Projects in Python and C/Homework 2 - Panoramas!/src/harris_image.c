@@ -2,9 +2,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <assert.h>
+#include <stdint.h>
 #include "image.h"
 #include "matrix.h"
+#include "gaussian_image.h"
+#include "descriptor_set.h"
 #include <time.h>
 
 #define FOREACH_PIXEL(W, H, FUNC) \
@@ -15,11 +19,26 @@ for (int j = 0; j < H; ++j) { \
 
 #define SQUARE(X) ((X) * (X))
 
+// Harris cornerness is det(S) - HARRIS_ALPHA * trace(S)^2.
+#define HARRIS_ALPHA .06f
+// Rows of the image each task of the fused Harris sweep produces.
+#define HARRIS_BAND 128
+
+// Columns of the response map the vertical pass of NMS handles at once.
+#define NMS_STRIP 256
+
 // Frees an array of descriptors.
 // descriptor *d: the array.
 // int n: number of elements in array.
 void free_descriptors(descriptor *d, int n)
 {
+    // A set's view owns every row, and an empty one is freed like any
+    // empty array.
+    descriptor_set s;
+    if(descriptor_set_of(d, n, &s)){
+        free_descriptor_set(s);
+        return;
+    }
     int i;
     for(i = 0; i < n; ++i){
         free(d[i].data);
@@ -27,35 +46,148 @@ void free_descriptors(descriptor *d, int n)
     free(d);
 }
 
-// Create a feature descriptor for an index in an image.
+// Fill in the feature descriptor of a pixel.
 // image im: source image.
-// int i: index in image for the pixel we want to describe.
-// returns: descriptor for that index.
-descriptor describe_index(image im, int i)
+// int x, y: pixel to describe.
+// float *out: filled with 5*5*im.c values.
+static void describe_pixel(image im, int x, int y, float *out)
 {
     int w = 5;
-    descriptor d;
-    d.p.x = i%im.w;
-    d.p.y = i/im.w;
-    d.data = calloc(w*w*im.c, sizeof(float));
-    d.n = w*w*im.c;
     int c, dx, dy;
     int count = 0;
     // If you want you can experiment with other descriptors
     // This subtracts the central value from neighbors
     // to compensate some for exposure/lighting changes.
+    if(x >= w/2 && x < im.w - w/2 && y >= w/2 && y < im.h - w/2){
+        // The whole window is inside the image, no clamping needed.
+        for(c = 0; c < im.c; ++c){
+            const float *center = im.data + c*im.w*im.h + y*im.w + x;
+            float cval = center[0];
+            for(dx = -w/2; dx < (w+1)/2; ++dx){
+                for(dy = -w/2; dy < (w+1)/2; ++dy){
+                    out[count++] = cval - center[dy*im.w + dx];
+                }
+            }
+        }
+        return;
+    }
     for(c = 0; c < im.c; ++c){
-        float cval = im.data[c*im.w*im.h + i];
+        float cval = get_pixel(im, x, y, c);
         for(dx = -w/2; dx < (w+1)/2; ++dx){
             for(dy = -w/2; dy < (w+1)/2; ++dy){
-                float val = get_pixel(im, i%im.w+dx, i/im.w+dy, c);
-                d.data[count++] = cval - val;
+                out[count++] = cval - get_pixel(im, x+dx, y+dy, c);
+            }
+        }
+    }
+}
+
+// BRIEF comparisons as offsets from the corner: bit k is set when the
+// smoothed image at (x+brief_pairs[k][0], y+brief_pairs[k][1]) is darker
+// than at (x+brief_pairs[k][2], y+brief_pairs[k][3]). Drawn once from an
+// isotropic Gaussian with std. dev. 2/5 of the patch width, as in the BRIEF
+// paper, and clipped to the patch.
+static signed char brief_pairs[BRIEF_BITS][4];
+static int brief_ready = 0;
+
+static void make_brief_pairs()
+{
+    if(brief_ready) return;
+    unsigned seed = 0x9e3779b9u;
+    float sigma = .4f*BRIEF_RADIUS;
+    int k, n;
+    for(k = 0; k < BRIEF_BITS; ++k){
+        for(n = 0; n < 4; n += 2){
+            float u[2];
+            int m;
+            for(m = 0; m < 2; ++m){
+                seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+                u[m] = (seed + 1.0f) / 4294967296.0f;
+            }
+            // Box-Muller gives two independent normal samples.
+            float r = sigma*sqrtf(-2*logf(u[0]));
+            int off[2] = {(int)roundf(r*cosf(2*M_PI*u[1])), (int)roundf(r*sinf(2*M_PI*u[1]))};
+            for(m = 0; m < 2; ++m){
+                if(off[m] < -BRIEF_RADIUS) off[m] = -BRIEF_RADIUS;
+                if(off[m] > BRIEF_RADIUS) off[m] = BRIEF_RADIUS;
+                brief_pairs[k][n+m] = off[m];
             }
         }
     }
+    brief_ready = 1;
+}
+
+// Fill in the binary descriptor of a pixel.
+// image im: smoothed 1-channel image.
+// int x, y: pixel to describe.
+// float *out: filled with BRIEF_WORDS words of comparison bits.
+static void describe_brief_pixel(image im, int x, int y, float *out)
+{
+    uint32_t words[BRIEF_WORDS] = {0};
+    int k;
+    if(x >= BRIEF_RADIUS && x < im.w - BRIEF_RADIUS && y >= BRIEF_RADIUS && y < im.h - BRIEF_RADIUS){
+        const float *center = im.data + y*im.w + x;
+        for(k = 0; k < BRIEF_BITS; ++k){
+            const signed char *p = brief_pairs[k];
+            uint32_t bit = center[p[1]*im.w + p[0]] < center[p[3]*im.w + p[2]];
+            words[k/32] |= bit << (k%32);
+        }
+    } else {
+        for(k = 0; k < BRIEF_BITS; ++k){
+            const signed char *p = brief_pairs[k];
+            uint32_t bit = get_pixel(im, x+p[0], y+p[1], 0) < get_pixel(im, x+p[2], y+p[3], 0);
+            words[k/32] |= bit << (k%32);
+        }
+    }
+    memcpy(out, words, sizeof(words));
+}
+
+// Create a feature descriptor for an index in an image.
+// image im: source image.
+// int i: index in image for the pixel we want to describe.
+// returns: descriptor for that index.
+descriptor describe_index(image im, int i)
+{
+    int w = 5;
+    descriptor d;
+    d.p.x = i%im.w;
+    d.p.y = i/im.w;
+    d.data = calloc(w*w*im.c, sizeof(float));
+    d.n = w*w*im.c;
+    d.kind = DESCRIPTOR_PATCH;
+    d.shared = 0;
+    describe_pixel(im, i%im.w, i/im.w, d.data);
     return d;
 }
 
+// Describe every point of a descriptor set, in parallel.
+// image im: source image.
+// descriptor_set s: set with points filled in, and a dim of 5*5*im.c for
+//                   DESCRIPTOR_PATCH or BRIEF_WORDS for DESCRIPTOR_BRIEF.
+void describe_points(image im, descriptor_set s)
+{
+    int i;
+    if(s.kind == DESCRIPTOR_BRIEF){
+        // Comparisons are made on the smoothed gray image, or the first
+        // channel if the image is not RGB.
+        make_brief_pairs();
+        image gray = im.c == 3 ? rgb_to_grayscale(im) : im;
+        image smooth = gaussian_blur(gray, BRIEF_SIGMA, GAUSSIAN_AUTO);
+        if(im.c == 3) free_image(gray);
+        #pragma omp parallel for
+        for(i = 0; i < s.n; ++i){
+            s.view[i].p = s.points[i];
+            describe_brief_pixel(smooth, s.points[i].x, s.points[i].y, s.view[i].data);
+        }
+        free_image(smooth);
+        return;
+    }
+    #pragma omp parallel for
+    for(i = 0; i < s.n; ++i){
+        s.view[i].p = s.points[i];
+        describe_pixel(im, s.points[i].x, s.points[i].y, s.view[i].data);
+    }
+}
+
 // Marks the spot of a point in an image.
 // image im: image to mark.
 // ponit p: spot to mark in the image.
@@ -86,52 +218,139 @@ void mark_corners(image im, descriptor *d, int n)
     }
 }
 
-// Creates a 1d Gaussian filter.
-// float sigma: standard deviation of Gaussian.
-// returns: single row image of the filter.
-image make_1d_gaussian(float sigma)
-{
-    // TODO: optional, make separable 1d Gaussian.
-    int w = (int)ceil(6 * sigma);
-    w = w & 1 ? w : w + 1;
-    int center = w / 2;
-    image img = make_image(w, 1, 1);
-    for (int i = 0; i < w; ++i) {
-        // without multiplying 1 / (TWOPI * SQUARE(sigma))
-        set_pixel(img, i, 0, 0, exp(-SQUARE(i - center) / (2 * SQUARE(sigma))));
-    }
-    return img;
-}
-
-// Smooths an image using separable Gaussian filter.
+// Smooths an image using a separable or recursive Gaussian filter.
 // image im: image to smooth.
 // float sigma: std dev. for Gaussian.
 // returns: smoothed image.
 image smooth_image(image im, float sigma)
 {
-    if(1){
-        image g = make_gaussian_filter(sigma);
-        image s = convolve_image(im, g, 1);
-        free_image(g);
-        return s;
-    } else {
-        // TODO: optional, use two convolutions with 1d gaussian filter.
-        // If you implement, disable the above if check.
-        image g = make_1d_gaussian(sigma);
-        image s1 = convolve_image(im, g, 1);
-        g.h = g.w;
-        g.w = 1;
-        image s2 = convolve_image(s1, g, 1);
-        double k = 1 / (TWOPI * SQUARE(sigma));
-        for (int i = 0; i < s2.w * s2.h; ++i) {
-            s2.data[i] *= k;
+    return gaussian_blur(im, sigma, GAUSSIAN_AUTO);
+}
+
+// Sobel derivatives of one image row, summed over channels like
+// convolve_image with preserve = 0. Borders are clamped.
+// image im: the input image.
+// int y: row to differentiate.
+// float *ix, *iy: filled with im.w derivatives each.
+static void gradient_row(image im, int y, float *ix, float *iy)
+{
+    int w = im.w;
+    int c, i;
+    memset(ix, 0, w*sizeof(float));
+    memset(iy, 0, w*sizeof(float));
+    for(c = 0; c < im.c; ++c){
+        const float *plane = im.data + c*w*im.h;
+        const float *up = plane + MAX(y - 1, 0)*w;
+        const float *mid = plane + y*w;
+        const float *down = plane + MIN(y + 1, im.h - 1)*w;
+        for(i = 1; i < w - 1; ++i){
+            ix[i] += (up[i+1] - up[i-1]) + 2*(mid[i+1] - mid[i-1]) + (down[i+1] - down[i-1]);
+            iy[i] += (down[i-1] + 2*down[i] + down[i+1]) - (up[i-1] + 2*up[i] + up[i+1]);
+        }
+        int edge[2] = {0, w - 1};
+        int n;
+        for(n = 0; n < (w > 1 ? 2 : 1); ++n){
+            i = edge[n];
+            int l = MAX(i - 1, 0), r = MIN(i + 1, w - 1);
+            ix[i] += (up[r] - up[l]) + 2*(mid[r] - mid[l]) + (down[r] - down[l]);
+            iy[i] += (down[l] + 2*down[i] + down[r]) - (up[l] + 2*up[i] + up[r]);
         }
-        free_image(g);
-        free_image(s1);
-        return s2;
     }
 }
 
+// One band of rows of the fused Harris sweep. Each image row is
+// differentiated, its gradient products are smoothed horizontally into a
+// ring of g.w rows, and every output row is the vertical sum over the ring,
+// so only a few rows are ever live. Same result as separable_blur of the
+// products, with clamped borders.
+// image im: the input image.
+// image g: 1d Gaussian to smooth with.
+// int y0, y1: rows to produce.
+// image S: if it has data, rows filled with the structure matrix.
+// image R: if it has data, rows filled with the cornerness.
+static void harris_band(image im, image g, int y0, int y1, image S, image R)
+{
+    int w = im.w, r = g.w / 2, k = g.w;
+    int pw = w + 2*r;
+    float *ring = malloc((size_t)k*3*w*sizeof(float));
+    float *prod = malloc(3*pw*sizeof(float));
+    float *ix = malloc(w*sizeof(float)), *iy = malloc(w*sizeof(float));
+    float *sum = malloc(3*w*sizeof(float));
+    int next = y0 - r;
+    int y, i, c, n;
+    for(y = y0; y < y1; ++y){
+        // Bring in the rows up to y + r, clamped at the top and bottom.
+        for(; next <= y + r; ++next){
+            gradient_row(im, MIN(MAX(next, 0), im.h - 1), ix, iy);
+            float *xx = prod + r, *yy = prod + pw + r, *xy = prod + 2*pw + r;
+            for(i = 0; i < w; ++i){
+                xx[i] = ix[i]*ix[i];
+                yy[i] = iy[i]*iy[i];
+                xy[i] = ix[i]*iy[i];
+            }
+            for(c = 0; c < 3; ++c){
+                float *p = prod + c*pw + r;
+                for(i = 1; i <= r; ++i){
+                    p[-i] = p[0];
+                    p[w - 1 + i] = p[w - 1];
+                }
+            }
+            float *dst = ring + (size_t)((next - y0 + r) % k)*3*w;
+            memset(dst, 0, 3*w*sizeof(float));
+            for(c = 0; c < 3; ++c){
+                const float *p = prod + c*pw;
+                float *d = dst + c*w;
+                for(n = 0; n < k; ++n){
+                    float gn = g.data[n];
+                    for(i = 0; i < w; ++i) d[i] += gn*p[i + n];
+                }
+            }
+        }
+        memset(sum, 0, 3*w*sizeof(float));
+        for(n = 0; n < k; ++n){
+            const float *src = ring + (size_t)((y + n - y0) % k)*3*w;
+            float wn = g.data[n];
+            for(i = 0; i < 3*w; ++i) sum[i] += wn*src[i];
+        }
+        if(S.data){
+            for(c = 0; c < 3; ++c) memcpy(S.data + c*w*S.h + y*w, sum + c*w, w*sizeof(float));
+        }
+        if(R.data){
+            float *dst = R.data + y*w;
+            for(i = 0; i < w; ++i){
+                float xx = sum[i], yy = sum[w + i], xy = sum[2*w + i];
+                float trace = xx + yy;
+                dst[i] = xx*yy - xy*xy - HARRIS_ALPHA*trace*trace;
+            }
+        }
+    }
+    free(ring);
+    free(prod);
+    free(ix);
+    free(iy);
+    free(sum);
+}
+
+// Run the fused Harris sweep over the whole image, a band per task.
+static void harris_sweep(image im, float sigma, image S, image R)
+{
+    image g = make_1d_gaussian(sigma);
+    int bands = (im.h + HARRIS_BAND - 1) / HARRIS_BAND;
+    int b;
+    #pragma omp parallel for schedule(dynamic)
+    for(b = 0; b < bands; ++b){
+        harris_band(im, g, b*HARRIS_BAND, MIN((b + 1)*HARRIS_BAND, im.h), S, R);
+    }
+    free_image(g);
+}
+
+// Whether smooth_image would use the exact separable Gaussian, which the
+// fused sweep reproduces. Wider ones use the recursive filter instead.
+static int sweep_matches_smooth(float sigma)
+{
+    return sigma <= GAUSSIAN_RECURSIVE_SIGMA;
+}
+
 // Calculate the structure matrix of an image.
 // image im: the input image.
 // float sigma: std dev. to use for weighted sum.
@@ -140,6 +359,11 @@ image smooth_image(image im, float sigma)
 image structure_matrix(image im, float sigma)
 {
     image S = make_image(im.w, im.h, 3);
+    if(sweep_matches_smooth(sigma)){
+        image none = {0};
+        harris_sweep(im, sigma, S, none);
+        return S;
+    }
     // TODO: calculate structure matrix for im.
     image gx = make_gx_filter();
     image gy = make_gy_filter();
@@ -169,7 +393,7 @@ image cornerness_response(image S)
     image R = make_image(S.w, S.h, 1);
     // TODO: fill in R, "cornerness" for each pixel using the structure matrix.
     // We'll use formulation det(S) - alpha * trace(S)^2, alpha = .06.
-    float alpha = 0.06;
+    float alpha = HARRIS_ALPHA;
     FOREACH_PIXEL(S.w, S.h, {
         float xx = get_pixel(S, i, j, 0);
         float yy = get_pixel(S, i, j, 1);
@@ -181,6 +405,108 @@ image cornerness_response(image S)
     return R;
 }
 
+// Cornerness of every pixel straight from the image, same as
+// cornerness_response(structure_matrix(im, sigma)) but in one sweep that
+// keeps neither the gradients nor the structure matrix.
+// image im: the input image.
+// float sigma: std dev. to use for weighted sum.
+// returns: a response map of cornerness calculations.
+image harris_response(image im, float sigma)
+{
+    if(!sweep_matches_smooth(sigma)){
+        image S = structure_matrix(im, sigma);
+        image R = cornerness_response(S);
+        free_image(S);
+        return R;
+    }
+    image R = make_image(im.w, im.h, 1);
+    image none = {0};
+    harris_sweep(im, sigma, none, R);
+    return R;
+}
+
+// Running maximum over windows of 2w+1 positions along one axis, in
+// constant time per position (van Herk/Gil-Werman). Positions are cut into
+// blocks of 2w+1, every window spans at most two of them, so its maximum is
+// the suffix max of one block and the prefix max of the next. Positions
+// past either end count as -FLT_MAX, so windows are clipped to the image,
+// which gives the same maximum as reading them with clamped get_pixel.
+// const float *in: n positions step floats apart, each len floats long.
+// float *out: written in the same layout.
+// int w: window radius.
+// float *g, *h: scratch for (n + 2w rounded up to 2w+1)*len floats each.
+static void running_max(const float *in, float *out, int n, int step, int len, int w, float *g, float *h)
+{
+    int k = 2*w + 1;
+    int m = (n + 2*w + k - 1) / k * k;
+    int p, i;
+    for(p = 0; p < m; ++p){
+        const float *src = p >= w && p < w + n ? in + (size_t)(p - w)*step : 0;
+        float *gp = g + (size_t)p*len;
+        if(p % k == 0){
+            for(i = 0; i < len; ++i) gp[i] = src ? src[i] : -FLT_MAX;
+        } else if(src){
+            for(i = 0; i < len; ++i) gp[i] = MAX(gp[i - len], src[i]);
+        } else {
+            memcpy(gp, gp - len, len*sizeof(float));
+        }
+    }
+    for(p = m - 1; p >= 0; --p){
+        const float *src = p >= w && p < w + n ? in + (size_t)(p - w)*step : 0;
+        float *hp = h + (size_t)p*len;
+        if(p % k == k - 1){
+            for(i = 0; i < len; ++i) hp[i] = src ? src[i] : -FLT_MAX;
+        } else if(src){
+            for(i = 0; i < len; ++i) hp[i] = MAX(hp[i + len], src[i]);
+        } else {
+            memcpy(hp, hp + len, len*sizeof(float));
+        }
+    }
+    for(p = 0; p < n; ++p){
+        const float *hp = h + (size_t)p*len, *gp = g + (size_t)(p + 2*w)*len;
+        float *dst = out + (size_t)p*step;
+        for(i = 0; i < len; ++i) dst[i] = MAX(hp[i], gp[i]);
+    }
+}
+
+// Largest response within w pixels of every pixel, a separable running max
+// over rows and then columns.
+// image im: 1-channel image of feature responses.
+// int w: distance to look for larger responses.
+// returns: the dilated responses.
+static image max_filter_image(image im, int w)
+{
+    image tmp = make_image(im.w, im.h, 1);
+    image out = make_image(im.w, im.h, 1);
+    int k = 2*w + 1;
+    #pragma omp parallel
+    {
+        int m = (im.w + 2*w + k - 1) / k * k;
+        float *g = malloc(m*sizeof(float)), *h = malloc(m*sizeof(float));
+        int j;
+        #pragma omp for
+        for(j = 0; j < im.h; ++j){
+            running_max(im.data + j*im.w, tmp.data + j*im.w, im.w, 1, 1, w, g, h);
+        }
+        free(g);
+        free(h);
+        // Columns go a strip at a time, every row of a strip in one pass.
+        m = (im.h + 2*w + k - 1) / k * k;
+        g = malloc((size_t)m*NMS_STRIP*sizeof(float));
+        h = malloc((size_t)m*NMS_STRIP*sizeof(float));
+        int x;
+        #pragma omp for
+        for(x = 0; x < im.w; x += NMS_STRIP){
+            int len = MIN(NMS_STRIP, im.w - x);
+            running_max(tmp.data + x, out.data + x, im.h, im.w, len, w, g, h);
+        }
+        free(g);
+        free(h);
+    }
+    free_image(tmp);
+    return out;
+}
+
 // Perform non-max supression on an image of feature responses.
 // image im: 1-channel image of feature responses.
 // int w: distance to look for larger responses.
@@ -188,79 +514,95 @@ image cornerness_response(image S)
 image nms_image(image im, int w)
 {
     image r = copy_image(im);
-    // TODO: perform NMS on the response map.
-    // for every pixel in the image:
-    //     for neighbors within w:
-    //         if neighbor response greater than pixel response:
-    //             set response to be very low (I use -999999 [why not 0??])
-    int width = 2 * w + 1;
-    int center_x = w;
-    int center_y = w;
-    FOREACH_PIXEL(r.w, r.h, {
-        int cur_i = i;
-        int cur_j = j;
-        float pixel = get_pixel(im, cur_i, cur_j, 0);
-        FOREACH_PIXEL(width, width, {
-            if (get_pixel(im, cur_i - (center_x - i), cur_j - (center_y - j), 0) > pixel) {
-                set_pixel(r, cur_i, cur_j, 0, -999999);
-                goto suppressed;
-            }
-        });
-suppressed:
-        ;
-    });
+    // A pixel survives if nothing within w is larger, that is if it equals
+    // the largest response around it. Others are set very low.
+    image d = max_filter_image(im, w);
+    int i;
+    for(i = 0; i < im.w*im.h; ++i){
+        if(im.data[i] < d.data[i]) r.data[i] = -999999;
+    }
+    free_image(d);
     return r;
 }
 
+// Find the local maxima of a response map that pass a threshold, the same
+// pixels nms_image keeps, without building the suppressed image.
+// image im: 1-channel image of feature responses.
+// int w: distance to look for larger responses.
+// float thresh: smallest response kept.
+// int *n: filled with the number of maxima.
+// returns: their indices in the image, in row order.
+int *nms_corners(image im, int w, float thresh, int *n)
+{
+    image d = max_filter_image(im, w);
+    int *rows = calloc(im.h + 1, sizeof(int));
+    int j;
+    // Count each row, then each row writes from its offset in the list.
+    #pragma omp parallel for
+    for(j = 0; j < im.h; ++j){
+        const float *r = im.data + j*im.w, *m = d.data + j*im.w;
+        int i, count = 0;
+        for(i = 0; i < im.w; ++i) count += r[i] >= m[i] && r[i] >= thresh;
+        rows[j + 1] = count;
+    }
+    for(j = 0; j < im.h; ++j) rows[j + 1] += rows[j];
+    int *list = malloc((rows[im.h] ? rows[im.h] : 1)*sizeof(int));
+    #pragma omp parallel for
+    for(j = 0; j < im.h; ++j){
+        const float *r = im.data + j*im.w, *m = d.data + j*im.w;
+        int i, count = rows[j];
+        for(i = 0; i < im.w; ++i){
+            if(r[i] >= m[i] && r[i] >= thresh) list[count++] = i + j*im.w;
+        }
+    }
+    *n = rows[im.h];
+    free(rows);
+    free_image(d);
+    return list;
+}
+
 // Perform harris corner detection and extract features from the corners.
 // image im: input image.
 // float sigma: std. dev for harris.
 // float thresh: threshold for cornerness.
 // int nms: distance to look for local-maxes in response map.
-// int *n: pointer to number of corners detected, should fill in.
-// returns: array of descriptors of the corners in the image.
-descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms, int *n)
+// DESCRIPTOR kind: descriptors to extract.
+// returns: descriptors of the corners in the image, in one allocation.
+descriptor_set harris_descriptor_set(image im, float sigma, float thresh, int nms, DESCRIPTOR kind)
 {
-    // Calculate structure matrix
-    image S = structure_matrix(im, sigma);
-
     // Estimate cornerness
-    image R = cornerness_response(S);
-
-    // Run NMS on the responses
-    image Rnms = nms_image(R, nms);
+    image R = harris_response(im, sigma);
 
-    //TODO: count number of responses over threshold
-    int count = 0; // change this
-    int capacity = 64;
-    int* arr = (int*)malloc(capacity * sizeof(int));
-    FOREACH_PIXEL(Rnms.w, Rnms.h, {
-        if (get_pixel(Rnms, i, j, 0) >= thresh) {
-            ++count;
-            if (count > capacity) {
-                capacity <<= 1;
-                int* new_arr = (int*)malloc(capacity * sizeof(int));
-                memcpy(new_arr, arr, (capacity >> 1) * sizeof(int));
-                free(arr);
-                arr = new_arr;
-            }
-            arr[count - 1] = i + j * Rnms.w;
-        }
-    });
-    
-    *n = count; // <- set *n equal to number of corners in image.
-    descriptor *d = calloc(count, sizeof(descriptor));
-    //TODO: fill in array *d with descriptors of corners, use describe_index.
-    descriptor *ptr = d;
-    for (int i = 0; i < count; ++i) {
-        *ptr++ = describe_index(im, arr[i]);
+    // Keep the local maxima over threshold
+    int count = 0;
+    int *corners = nms_corners(R, nms, thresh, &count);
+    descriptor_set s = make_descriptor_set(count, kind == DESCRIPTOR_BRIEF ? BRIEF_WORDS : 5*5*im.c, kind);
+    int i;
+    for(i = 0; i < count; ++i){
+        s.points[i].x = corners[i] % R.w;
+        s.points[i].y = corners[i] / R.w;
     }
-    free(arr);
+    free(corners);
+    describe_points(im, s);
 
-    free_image(S);
     free_image(R);
-    free_image(Rnms);
-    return d;
+    return s;
+}
+
+// Perform harris corner detection and extract features from the corners.
+// image im: input image.
+// float sigma: std. dev for harris.
+// float thresh: threshold for cornerness.
+// int nms: distance to look for local-maxes in response map.
+// int *n: pointer to number of corners detected, should fill in.
+// returns: array of descriptors of the corners in the image, a view of a
+//          descriptor_set that free_descriptors releases in one call. They
+//          are of the kind chosen with set_descriptor_type.
+descriptor *harris_corner_detector(image im, float sigma, float thresh, int nms, int *n)
+{
+    descriptor_set s = harris_descriptor_set(im, sigma, thresh, nms, get_descriptor_type());
+    *n = s.n;
+    return s.view;
 }
 
 // Find and draw corners on an image.
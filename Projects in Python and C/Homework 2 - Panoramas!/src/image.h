@@ -22,10 +22,17 @@ typedef struct{
 // A descriptor for a point in an image.
 // point p: x,y coordinates of the image pixel.
 // int n: the number of floating point values in the descriptor.
+// unsigned char kind: what the values are, a DESCRIPTOR from
+//                     descriptor_set.h. 0 is the patch describe_index makes.
+// unsigned char shared: 0 if data is allocated on its own. Otherwise data
+//                       points into the allocation of a descriptor_set's
+//                       view, which starts at the descriptor marked 1 and
+//                       goes on with ones marked 2.
 // float *data: the descriptor for the pixel.
 typedef struct{
     point p;
     int n;
+    unsigned char kind, shared;
     float *data;
 } descriptor;
 
@@ -3,6 +3,8 @@
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "match_index.h"
+#include "descriptor_set.h"
 
 int main(int argc, char **argv)
 {
@@ -10,7 +12,7 @@ int main(int argc, char **argv)
     char *out = find_char_arg(argc, argv, "-o", "out");
     //float scale = find_float_arg(argc, argv, "-s", 1);
     if(argc < 2){
-        printf("usage: %s [test | grayscale]\n", argv[0]);  
+        printf("usage: %s [test | grayscale | matchbench]\n", argv[0]);
     } else if (0 == strcmp(argv[1], "test")){
         run_tests();
     } else if (0 == strcmp(argv[1], "grayscale")){
@@ -19,6 +21,21 @@ int main(int argc, char **argv)
         save_image(g, out);
         free_image(im);
         free_image(g);
+    } else if (0 == strcmp(argv[1], "matchbench")){
+        image a = load_image(find_char_arg(argc, argv, "-a", "data/Rainier1.png"));
+        image b = load_image(find_char_arg(argc, argv, "-b", "data/Rainier2.png"));
+        float sigma = find_float_arg(argc, argv, "-s", 2);
+        float thresh = find_float_arg(argc, argv, "-t", 5);
+        int nms = find_int_arg(argc, argv, "-n", 3);
+        if(find_arg(argc, argv, "-brief")) set_descriptor_type(DESCRIPTOR_BRIEF);
+        int an = 0, bn = 0;
+        descriptor *ad = harris_corner_detector(a, sigma, thresh, nms, &an);
+        descriptor *bd = harris_corner_detector(b, sigma, thresh, nms, &bn);
+        match_benchmark(ad, an, bd, bn);
+        free_descriptors(ad, an);
+        free_descriptors(bd, bn);
+        free_image(a);
+        free_image(b);
     }
     return 0;
 }
@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include "image.h"
+#include "match_index.h"
+#include "descriptor_set.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Most points a leaf holds.
+#define KD_LEAF 8
+// Points used to estimate the spread of each dimension at a split.
+#define KD_SAMPLE 128
+// Splits pick at random among this many highest variance dimensions.
+#define KD_TOP 5
+// Exact matching compares blocks of queries against tiles of candidates
+// small enough to stay in L1 while the block passes over them.
+#define L1_QUERIES 8
+#define L1_TILE 64
+// Exact matching sums this many floats of every candidate in a tile first,
+// and only finishes the ones that can still beat the second best.
+#define L1_PREFIX 32
+
+static match_params matcher = {MATCH_EXACT, 4, 64, 0};
+
+// L1 distance between two zero padded rows.
+// const float *a, *b: rows, 32 byte aligned.
+// int n: row length, a multiple of L1_LANES.
+// returns: the distance.
+#if defined(__AVX2__)
+static inline float hsum8(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __m256 l1_chunk(__m256 acc, const float *a, const float *b)
+{
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    return _mm256_add_ps(acc, _mm256_and_ps(_mm256_sub_ps(_mm256_load_ps(a), _mm256_load_ps(b)), mask));
+}
+
+static inline float l1_span(const float *a, const float *b, int n)
+{
+    // Four independent sums so the adds do not wait on each other.
+    __m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    int i;
+    for(i = 0; i + 32 <= n; i += 32){
+        s0 = l1_chunk(s0, a + i, b + i);
+        s1 = l1_chunk(s1, a + i + 8, b + i + 8);
+        s2 = l1_chunk(s2, a + i + 16, b + i + 16);
+        s3 = l1_chunk(s3, a + i + 24, b + i + 24);
+    }
+    if(i < n) s0 = l1_chunk(s0, a + i, b + i);
+    if(i + 8 < n) s1 = l1_chunk(s1, a + i + 8, b + i + 8);
+    if(i + 16 < n) s2 = l1_chunk(s2, a + i + 16, b + i + 16);
+    return hsum8(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+}
+#elif defined(__SSE2__)
+static inline float hsum4(__m128 s)
+{
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __m128 l1_chunk(__m128 acc, const float *a, const float *b)
+{
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    return _mm_add_ps(acc, _mm_and_ps(_mm_sub_ps(_mm_load_ps(a), _mm_load_ps(b)), mask));
+}
+
+static inline float l1_span(const float *a, const float *b, int n)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    int i;
+    for(i = 0; i + 16 <= n; i += 16){
+        s0 = l1_chunk(s0, a + i, b + i);
+        s1 = l1_chunk(s1, a + i + 4, b + i + 4);
+        s2 = l1_chunk(s2, a + i + 8, b + i + 8);
+        s3 = l1_chunk(s3, a + i + 12, b + i + 12);
+    }
+    if(i < n){
+        s0 = l1_chunk(s0, a + i, b + i);
+        s1 = l1_chunk(s1, a + i + 4, b + i + 4);
+    }
+    return hsum4(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+}
+#else
+static inline float l1_span(const float *a, const float *b, int n)
+{
+    float acc[L1_LANES] = {0};
+    int i, k;
+    for(i = 0; i < n; i += L1_LANES){
+        for(k = 0; k < L1_LANES; ++k) acc[k] += fabsf(a[i + k] - b[i + k]);
+    }
+    float s = 0;
+    for(k = 0; k < L1_LANES; ++k) s += acc[k];
+    return s;
+}
+#endif
+
+// L1 distance summed in the same two parts exact_nearest uses, so the
+// forest and the exact search agree to the last bit.
+static inline float l1_row(const float *a, const float *b, int n)
+{
+    int p = n < L1_PREFIX ? n : L1_PREFIX;
+    return l1_span(a, b, p) + l1_span(a + p, b + p, n - p);
+}
+
+// Copy descriptors into one block of zero padded, 64 byte aligned rows.
+// descriptor *d: descriptors to copy, all of length dim.
+// int n: number of descriptors.
+// int stride: padded row length, a multiple of L1_LANES.
+// returns: the block, free with free.
+static float *pack_descriptors(descriptor *d, int n, int dim, int stride)
+{
+    size_t bytes = (size_t)n*stride*sizeof(float);
+    float *vals = aligned_alloc(64, (bytes + 63) / 64 * 64 + 64);
+    memset(vals, 0, bytes);
+    int i;
+    for(i = 0; i < n; ++i){
+        memcpy(vals + (size_t)i*stride, d[i].data, dim*sizeof(float));
+    }
+    return vals;
+}
+
+// Descriptors as zero padded, aligned rows. The view of a descriptor_set
+// already is one and is used in place, anything else is packed.
+// int *packed: set to 1 if the rows were copied and must be freed.
+// returns: the rows.
+static float *descriptor_rows(descriptor *d, int n, int dim, int stride, int *packed)
+{
+    descriptor_set s;
+    *packed = !descriptor_set_of(d, n, &s) || s.stride != stride;
+    return *packed ? pack_descriptors(d, n, dim, stride) : s.vals;
+}
+
+// Keep the best and second best candidates seen by one query.
+// Ties go to the lower index.
+static inline void keep_best(float d, int i, int *best, float *dist, float *second)
+{
+    if(d < *dist || (d == *dist && i < *best)){
+        *second = *dist;
+        *dist = d;
+        *best = i;
+    } else if(d < *second){
+        *second = d;
+    }
+}
+
+// Choose how match_descriptors searches, for every later call.
+void set_match_params(match_params p)
+{
+    matcher = p;
+}
+
+match_params get_match_params()
+{
+    return matcher;
+}
+
+// Small private generator so building an index leaves rand() alone,
+// RANSAC sequences stay the same whichever matcher is used.
+static unsigned xorshift(unsigned *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+// Build the subtree over order[start, start + count).
+// returns: index of the subtree's root node.
+static int build_node(match_index *idx, kd_tree *t, int *used, int start, int count, unsigned *seed)
+{
+    int node = (*used)++;
+    kd_node *k = t->nodes + node;
+    k->dim = -1;
+    k->child[0] = start;
+    k->child[1] = count;
+    if(count <= KD_LEAF) return node;
+
+    int dim = idx->dim;
+    int *order = t->order + start;
+    int stride = idx->stride;
+    int samples = count < KD_SAMPLE ? count : KD_SAMPLE;
+    double *mean = calloc(dim, sizeof(double));
+    double *var = calloc(dim, sizeof(double));
+    int i, j, d;
+    for(i = 0; i < samples; ++i){
+        const float *v = idx->vals + (size_t)order[i]*stride;
+        for(d = 0; d < dim; ++d) mean[d] += v[d];
+    }
+    for(d = 0; d < dim; ++d) mean[d] /= samples;
+    for(i = 0; i < samples; ++i){
+        const float *v = idx->vals + (size_t)order[i]*stride;
+        for(d = 0; d < dim; ++d) var[d] += (v[d] - mean[d])*(v[d] - mean[d]);
+    }
+
+    int top[KD_TOP];
+    int ntop = 0;
+    for(d = 0; d < dim; ++d){
+        if(ntop < KD_TOP) ++ntop;
+        else if(var[d] <= var[top[KD_TOP-1]]) continue;
+        for(j = ntop - 1; j > 0 && var[top[j-1]] < var[d]; --j) top[j] = top[j-1];
+        top[j] = d;
+    }
+    d = top[xorshift(seed) % ntop];
+    float split = mean[d];
+    free(mean);
+    free(var);
+
+    // Partition the points below the split to the front.
+    int left = 0;
+    for(i = 0; i < count; ++i){
+        if(idx->vals[(size_t)order[i]*stride + d] < split){
+            int tmp = order[i];
+            order[i] = order[left];
+            order[left++] = tmp;
+        }
+    }
+    if(left == 0 || left == count) return node;
+
+    k->dim = d;
+    k->split = split;
+    int l = build_node(idx, t, used, start, left, seed);
+    int r = build_node(idx, t, used, start + left, count - left, seed);
+    t->nodes[node].child[0] = l;
+    t->nodes[node].child[1] = r;
+    return node;
+}
+
+// Build a randomized k-d forest over a set of descriptors.
+// Each tree splits on a random pick of the highest variance dimensions,
+// so the trees partition the space differently and miss different things.
+// descriptor *b: descriptors to index, copied into the index.
+// int bn: number of descriptors.
+// int trees: number of trees to build.
+// returns: the index.
+match_index make_match_index(descriptor *b, int bn, int trees)
+{
+    match_index idx;
+    idx.n = bn;
+    idx.dim = bn ? b[0].n : 0;
+    idx.stride = (idx.dim + L1_LANES - 1) / L1_LANES * L1_LANES;
+    idx.trees = trees;
+    idx.vals = pack_descriptors(b, bn, idx.dim, idx.stride);
+    int t;
+    idx.forest = calloc(trees, sizeof(kd_tree));
+    #pragma omp parallel for
+    for(t = 0; t < trees; ++t){
+        kd_tree *tree = idx.forest + t;
+        unsigned seed = 2654435761u*(t + 1);
+        int used = 0, j;
+        tree->nodes = calloc(2*bn + 1, sizeof(kd_node));
+        tree->order = calloc(bn + 1, sizeof(int));
+        for(j = 0; j < bn; ++j) tree->order[j] = j;
+        build_node(&idx, tree, &used, 0, bn, &seed);
+    }
+    return idx;
+}
+
+void free_match_index(match_index idx)
+{
+    int t;
+    for(t = 0; t < idx.trees; ++t){
+        free(idx.forest[t].nodes);
+        free(idx.forest[t].order);
+    }
+    free(idx.forest);
+    free(idx.vals);
+}
+
+// A branch not yet searched.
+// float priority: summed distances to the splits crossed to reach it.
+// float bound: largest single one of them, a true lower bound on the
+//              L1 distance to anything in the branch.
+typedef struct{
+    float priority, bound;
+    int tree, node;
+} kd_branch;
+
+// Per thread search state.
+typedef struct{
+    kd_branch *heap;
+    int size, cap;
+    int *seen;
+    int query;
+    int checked;
+    int best;
+    float dist, second;
+} kd_search;
+
+static void heap_push(kd_search *s, kd_branch b)
+{
+    if(s->size == s->cap){
+        s->cap = s->cap ? 2*s->cap : 64;
+        s->heap = realloc(s->heap, s->cap*sizeof(kd_branch));
+    }
+    int i = s->size++;
+    while(i > 0 && s->heap[(i-1)/2].priority > b.priority){
+        s->heap[i] = s->heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    s->heap[i] = b;
+}
+
+static kd_branch heap_pop(kd_search *s)
+{
+    kd_branch top = s->heap[0];
+    kd_branch last = s->heap[--s->size];
+    int i = 0;
+    for(;;){
+        int c = 2*i + 1;
+        if(c >= s->size) break;
+        if(c + 1 < s->size && s->heap[c+1].priority < s->heap[c].priority) ++c;
+        if(s->heap[c].priority >= last.priority) break;
+        s->heap[i] = s->heap[c];
+        i = c;
+    }
+    s->heap[i] = last;
+    return top;
+}
+
+// Walk from a node down to a leaf, queueing the far side of every split,
+// then compare q against the leaf's points not seen yet for this query.
+static void descend(match_index idx, kd_search *s, const float *q, kd_branch b)
+{
+    kd_tree *t = idx.forest + b.tree;
+    kd_node *k = t->nodes + b.node;
+    while(k->dim >= 0){
+        float diff = q[k->dim] - k->split;
+        float far = fabsf(diff);
+        kd_branch other = {b.priority + far, far > b.bound ? far : b.bound, b.tree, k->child[diff < 0]};
+        if(other.bound < s->second) heap_push(s, other);
+        k = t->nodes + k->child[diff >= 0];
+    }
+    int i;
+    for(i = k->child[0]; i < k->child[0] + k->child[1]; ++i){
+        int p = t->order[i];
+        if(s->seen[p] == s->query) continue;
+        s->seen[p] = s->query;
+        ++s->checked;
+        float d = l1_row(q, idx.vals + (size_t)p*idx.stride, idx.stride);
+        keep_best(d, p, &s->best, &s->dist, &s->second);
+    }
+}
+
+// Find the approximate nearest indexed descriptor for each query.
+// Best-bin-first: every tree is walked once, then the closest unexplored
+// branches across all trees are searched until checks descriptors have
+// been compared. Ties go to the lower index, like exact_nearest.
+// match_index idx: index to search.
+// descriptor *a: queries.
+// int an: number of queries.
+// int checks: descriptors to compare per query.
+// int *nearest: filled with the index of each query's neighbour.
+// float *dist: filled with the L1 distance to it.
+// float *second: if not null, filled with the distance to the second
+//                nearest descriptor that was compared.
+void query_match_index(match_index idx, descriptor *a, int an, int checks, int *nearest, float *dist, float *second)
+{
+    int packed;
+    float *queries = descriptor_rows(a, an, idx.dim, idx.stride, &packed);
+    #pragma omp parallel
+    {
+        kd_search s = {0};
+        s.seen = malloc((idx.n + 1)*sizeof(int));
+        memset(s.seen, -1, (idx.n + 1)*sizeof(int));
+        int j, t;
+        #pragma omp for
+        for(j = 0; j < an; ++j){
+            const float *q = queries + (size_t)j*idx.stride;
+            s.size = 0;
+            s.query = j;
+            s.checked = 0;
+            s.best = -1;
+            s.dist = s.second = INFINITY;
+            for(t = 0; t < idx.trees && idx.n; ++t){
+                kd_branch root = {0, 0, t, 0};
+                descend(idx, &s, q, root);
+            }
+            while(s.checked < checks && s.size){
+                kd_branch b = heap_pop(&s);
+                if(b.bound < s.second) descend(idx, &s, q, b);
+            }
+            nearest[j] = s.best;
+            dist[j] = s.dist;
+            if(second) second[j] = s.second;
+        }
+        free(s.heap);
+        free(s.seen);
+    }
+    if(packed) free(queries);
+}
+
+// Find the nearest descriptor in b for each descriptor in a by comparing
+// against all of them. Blocks of queries sweep over tiles of b that stay in
+// cache. Candidates whose first L1_PREFIX values already add up to more than
+// the query's second best are dropped without finishing them, so the second
+// nearest distance comes out exact at no extra cost.
+// Query blocks are spread across threads.
+// descriptor *a, *b: queries and candidates, all of the same length.
+// int an, bn: number of each.
+// int *nearest: filled with the index in b of each query's neighbour.
+// float *dist: filled with the L1 distance to it.
+// float *second: if not null, filled with the distance to the second
+//                nearest descriptor.
+void exact_nearest(descriptor *a, int an, descriptor *b, int bn, int *nearest, float *dist, float *second)
+{
+    if(an == 0) return;
+    int dim = a[0].n;
+    int stride = (dim + L1_LANES - 1) / L1_LANES * L1_LANES;
+    int apacked, bpacked;
+    float *av = descriptor_rows(a, an, dim, stride, &apacked);
+    float *bv = descriptor_rows(b, bn, dim, stride, &bpacked);
+    int prefix = stride < L1_PREFIX ? stride : L1_PREFIX;
+    int blocks = (an + L1_QUERIES - 1) / L1_QUERIES;
+    int n;
+    #pragma omp parallel for schedule(dynamic)
+    for(n = 0; n < blocks; ++n){
+        int q0 = n*L1_QUERIES;
+        int qn = an - q0 < L1_QUERIES ? an - q0 : L1_QUERIES;
+        int best[L1_QUERIES], alive[L1_TILE];
+        float d1[L1_QUERIES], d2[L1_QUERIES], partial[L1_TILE];
+        int q, i, k, t;
+        for(q = 0; q < qn; ++q){
+            best[q] = -1;
+            d1[q] = d2[q] = INFINITY;
+        }
+        for(t = 0; t < bn; t += L1_TILE){
+            int tn = bn - t < L1_TILE ? bn - t : L1_TILE;
+            for(q = 0; q < qn; ++q){
+                const float *qv = av + (size_t)(q0 + q)*stride;
+                // Sum the prefix of every candidate, keeping the ones still
+                // under the second best without a branch per candidate.
+                float limit = d2[q];
+                int live = 0;
+                for(i = 0; i < tn; ++i){
+                    partial[i] = l1_span(qv, bv + (size_t)(t + i)*stride, prefix);
+                    alive[live] = i;
+                    live += partial[i] < limit;
+                }
+                for(k = 0; k < live; ++k){
+                    i = alive[k];
+                    float d = partial[i] + l1_span(qv + prefix, bv + (size_t)(t + i)*stride + prefix, stride - prefix);
+                    if(d < d2[q]) keep_best(d, t + i, best + q, d1 + q, d2 + q);
+                }
+            }
+        }
+        for(q = 0; q < qn; ++q){
+            nearest[q0 + q] = best[q];
+            dist[q0 + q] = d1[q];
+            if(second) second[q0 + q] = d2[q];
+        }
+    }
+    if(apacked) free(av);
+    if(bpacked) free(bv);
+}
+
+// Bits set in a word. Without a POPCNT instruction the builtin would be a
+// library call, so count in parallel within the word instead.
+static inline int popcount64(uint64_t x)
+{
+#if defined(__POPCNT__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (x*0x0101010101010101ull) >> 56;
+#endif
+}
+
+// Hamming distance between two binary descriptors.
+// float *a, *b: descriptors, bits packed in the float slots.
+// int words: number of 32 bit words in each, even.
+// returns: number of bits that differ.
+int hamming_distance(float *a, float *b, int words)
+{
+    int i, d = 0;
+    for(i = 0; i < words; i += 2){
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        d += popcount64(x ^ y);
+    }
+    return d;
+}
+
+#if BRIEF_BITS == 256 && defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+#define HAMMING4
+// Hamming distances from one query to four candidates, one 256 bit row each.
+static inline __m128i hamming4(__m256i q, const float *b)
+{
+    __m256i d[4];
+    int k;
+    for(k = 0; k < 4; ++k){
+        d[k] = _mm256_popcnt_epi64(_mm256_xor_si256(q, _mm256_load_si256((const __m256i *)(b + k*BRIEF_WORDS))));
+    }
+    // Sum the four 64 bit lanes of each candidate: pair the candidates in
+    // the two 32 bit halves of a lane, fold lanes, then fold the halves.
+    __m256i d01 = _mm256_or_si256(d[0], _mm256_slli_epi64(d[1], 32));
+    __m256i d23 = _mm256_or_si256(d[2], _mm256_slli_epi64(d[3], 32));
+    __m256i s = _mm256_add_epi64(_mm256_unpacklo_epi64(d01, d23), _mm256_unpackhi_epi64(d01, d23));
+    return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+}
+#elif BRIEF_BITS == 256 && defined(__AVX2__)
+#define HAMMING4
+// Bits set in each byte, looked up a nibble at a time.
+static inline __m256i popcount_bytes(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    return _mm256_add_epi8(lo, hi);
+}
+
+// Hamming distances from one query to four candidates, one 256 bit row each.
+static inline __m128i hamming4(__m256i q, const float *b)
+{
+    __m256i d[4];
+    int k;
+    for(k = 0; k < 4; ++k){
+        __m256i x = _mm256_xor_si256(q, _mm256_load_si256((const __m256i *)(b + k*BRIEF_WORDS)));
+        d[k] = _mm256_sad_epu8(popcount_bytes(x), _mm256_setzero_si256());
+    }
+    // Sum the four 64 bit lanes of each candidate: pair the candidates in
+    // the two 32 bit halves of a lane, fold lanes, then fold the halves.
+    __m256i d01 = _mm256_or_si256(d[0], _mm256_slli_epi64(d[1], 32));
+    __m256i d23 = _mm256_or_si256(d[2], _mm256_slli_epi64(d[3], 32));
+    __m256i s = _mm256_add_epi64(_mm256_unpacklo_epi64(d01, d23), _mm256_unpackhi_epi64(d01, d23));
+    return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+}
+#endif
+
+// Find the nearest binary descriptor in b for each one in a, by Hamming
+// distance over every candidate. Queries are spread across threads.
+// descriptor *a, *b: queries and candidates, BRIEF_WORDS words each.
+// int an, bn: number of each.
+// int *nearest: filled with the index in b of each query's neighbour.
+// float *dist: filled with the number of differing bits.
+// float *second: if not null, filled with the distance to the second
+//                nearest descriptor.
+void hamming_nearest(descriptor *a, int an, descriptor *b, int bn, int *nearest, float *dist, float *second)
+{
+    if(an == 0) return;
+    int apacked, bpacked;
+    float *av = descriptor_rows(a, an, BRIEF_WORDS, BRIEF_WORDS, &apacked);
+    float *bv = descriptor_rows(b, bn, BRIEF_WORDS, BRIEF_WORDS, &bpacked);
+    int j;
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(j = 0; j < an; ++j){
+        float *q = av + (size_t)j*BRIEF_WORDS;
+        int best = -1;
+        float d1 = INFINITY, d2 = INFINITY;
+        int i = 0;
+#if defined(HAMMING4)
+        __m256i qv = _mm256_load_si256((const __m256i *)q);
+        for(; i + 4 <= bn; i += 4){
+            int d[4], k;
+            _mm_storeu_si128((__m128i *)d, hamming4(qv, bv + (size_t)i*BRIEF_WORDS));
+            for(k = 0; k < 4; ++k){
+                if(d[k] < d2) keep_best(d[k], i + k, &best, &d1, &d2);
+            }
+        }
+#endif
+        for(; i < bn; ++i){
+            float d = hamming_distance(q, bv + (size_t)i*BRIEF_WORDS, BRIEF_WORDS);
+            if(d < d2) keep_best(d, i, &best, &d1, &d2);
+        }
+        nearest[j] = best;
+        dist[j] = d1;
+        if(second) second[j] = d2;
+    }
+    if(apacked) free(av);
+    if(bpacked) free(bv);
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Print recall and time of the k-d forest against exact matching.
+// Recall is the fraction of queries whose neighbour is as close as the
+// exact one. Binary descriptors only time the Hamming search.
+// descriptor *a, *b: queries and candidates.
+// int an, bn: number of each.
+void match_benchmark(descriptor *a, int an, descriptor *b, int bn)
+{
+    int *exact = calloc(an, sizeof(int)), *near = calloc(an, sizeof(int));
+    float *edist = calloc(an, sizeof(float)), *ndist = calloc(an, sizeof(float));
+    int trees[3] = {1, 4, 8};
+    int checks[5] = {16, 32, 64, 128, 256};
+    int t, c, j;
+
+    printf("%d x %d descriptors\n", an, bn);
+    double start;
+    descriptor_set as;
+    if(descriptor_set_of(a, an, &as) && as.kind == DESCRIPTOR_BRIEF){
+        start = now();
+        for(j = 0; j < an; ++j){
+            int i;
+            ndist[j] = INFINITY;
+            for(i = 0; i < bn; ++i){
+                float d = hamming_distance(a[j].data, b[i].data, BRIEF_WORDS);
+                if(d < ndist[j]) ndist[j] = d;
+            }
+        }
+        printf("scalar hamming  %8.2f ms\n", 1000*(now() - start));
+        start = now();
+        hamming_nearest(a, an, b, bn, exact, edist, 0);
+        printf("hamming         %8.2f ms\n", 1000*(now() - start));
+        free(exact); free(near); free(edist); free(ndist);
+        return;
+    }
+    start = now();
+    for(j = 0; j < an; ++j){
+        int i;
+        ndist[j] = INFINITY;
+        for(i = 0; i < bn; ++i){
+            float d = l1_distance(a[j].data, b[i].data, a[j].n);
+            if(d < ndist[j]) ndist[j] = d;
+        }
+    }
+    printf("scalar l1       %8.2f ms  recall 1.000\n", 1000*(now() - start));
+    start = now();
+    exact_nearest(a, an, b, bn, exact, edist, 0);
+    printf("exact           %8.2f ms  recall 1.000\n", 1000*(now() - start));
+    for(t = 0; t < 3; ++t){
+        start = now();
+        match_index idx = make_match_index(b, bn, trees[t]);
+        double build = now() - start;
+        for(c = 0; c < 5; ++c){
+            start = now();
+            query_match_index(idx, a, an, checks[c], near, ndist, 0);
+            double query = now() - start;
+            int found = 0;
+            for(j = 0; j < an; ++j) found += ndist[j] <= edist[j];
+            printf("trees %d checks %3d %8.2f ms  recall %.3f  (build %.2f ms)\n",
+                    trees[t], checks[c], 1000*query, an ? (float)found/an : 1, 1000*build);
+        }
+        free_match_index(idx);
+    }
+    free(exact); free(near); free(edist); free(ndist);
+}
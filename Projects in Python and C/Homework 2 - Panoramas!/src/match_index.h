@@ -0,0 +1,68 @@
+#ifndef MATCH_INDEX_H
+#define MATCH_INDEX_H
+#include "image.h"
+
+// Descriptor rows are padded with zeros to a multiple of this many floats
+// so distance kernels never need a scalar tail.
+#define L1_LANES 8
+
+// How match_descriptors finds the nearest descriptor in b.
+// MATCH_EXACT:    compare against every descriptor.
+// MATCH_KDFOREST: approximate search in a randomized k-d forest.
+typedef enum{MATCH_EXACT, MATCH_KDFOREST} MATCHER;
+
+// Matcher settings.
+// MATCHER method: search to use.
+// int trees: trees in the forest, more trees find more true neighbours.
+// int checks: descriptors compared per query, the accuracy/speed knob.
+//             At least bn makes the forest exact.
+// float ratio: if above 0, drop matches whose distance is more than ratio
+//              times the distance to the second nearest descriptor.
+typedef struct{
+    MATCHER method;
+    int trees;
+    int checks;
+    float ratio;
+} match_params;
+
+// A node of a k-d tree. Inner nodes split on dim at split, leaves have
+// dim < 0 and hold child[1] points starting at child[0] in the tree's order.
+typedef struct{
+    int dim;
+    float split;
+    int child[2];
+} kd_node;
+
+typedef struct{
+    kd_node *nodes;
+    int *order;
+} kd_tree;
+
+// A randomized k-d forest over a set of descriptors.
+// int n, dim: number of descriptors and values in each.
+// int stride: floats between rows of vals, dim rounded up to L1_LANES.
+// float *vals: the descriptors, one zero padded row each.
+// int trees: number of trees.
+// kd_tree *forest: the trees.
+typedef struct{
+    int n, dim;
+    int stride;
+    float *vals;
+    int trees;
+    kd_tree *forest;
+} match_index;
+
+float l1_distance(float *a, float *b, int n);
+int hamming_distance(float *a, float *b, int words);
+void set_match_params(match_params p);
+match_params get_match_params();
+match *match_descriptors_params(descriptor *a, int an, descriptor *b, int bn, int *mn, match_params p);
+
+match_index make_match_index(descriptor *b, int bn, int trees);
+void free_match_index(match_index idx);
+void query_match_index(match_index idx, descriptor *a, int an, int checks, int *nearest, float *dist, float *second);
+void exact_nearest(descriptor *a, int an, descriptor *b, int bn, int *nearest, float *dist, float *second);
+void hamming_nearest(descriptor *a, int an, descriptor *b, int bn, int *nearest, float *dist, float *second);
+void match_benchmark(descriptor *a, int an, descriptor *b, int bn);
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+#include "padded_image.h"
+
+#define ALIGN_FLOATS 16
+
+static int round_up(int n, int m)
+{
+    return (n + m - 1) / m * m;
+}
+
+// Map a coordinate outside [0, n) back inside according to a border policy.
+// returns: index in [0, n), or -1 for BORDER_ZERO outside the image.
+static int border_index(int i, int n, BORDER border)
+{
+    if(i >= 0 && i < n) return i;
+    if(border == BORDER_ZERO) return -1;
+    if(border == BORDER_CLAMP) return i < 0 ? 0 : n - 1;
+    if(border == BORDER_WRAP) return ((i % n) + n) % n;
+    // BORDER_REFLECT, period 2n with the edge pixel repeated.
+    i = ((i % (2*n)) + 2*n) % (2*n);
+    return i < n ? i : 2*n - 1 - i;
+}
+
+// Allocate a padded image with a zeroed interior and halo.
+// int w, h, c: image size.
+// int pad: halo width on each side.
+// BORDER border: policy used when the halo is refreshed.
+// returns: the padded image, with a clean halo.
+padded_image make_padded_image(int w, int h, int c, int pad, BORDER border)
+{
+    padded_image p;
+    int lead = round_up(pad, ALIGN_FLOATS);
+    p.w = w; p.h = h; p.c = c;
+    p.pad = pad;
+    p.border = border;
+    p.stride = round_up(lead + w + pad, ALIGN_FLOATS);
+    p.plane = p.stride * (h + 2*pad);
+    size_t bytes = (size_t)p.plane * c * sizeof(float);
+    p.base = aligned_alloc(ALIGN_FLOATS*sizeof(float), round_up(bytes, ALIGN_FLOATS*sizeof(float)));
+    memset(p.base, 0, bytes);
+    p.data = p.base + pad*p.stride + lead;
+    p.dirty = 0;
+    return p;
+}
+
+// Copy an image into a new padded image and fill its halo.
+// image im: image to copy.
+// int pad: halo width on each side.
+// BORDER border: how to fill the halo.
+// returns: the padded copy.
+padded_image pad_image(image im, int pad, BORDER border)
+{
+    padded_image p = make_padded_image(im.w, im.h, im.c, pad, border);
+    int k, j;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < im.h; ++j){
+            memcpy(padded_row(p, j, k), im.data + k*im.w*im.h + j*im.w, im.w*sizeof(float));
+        }
+    }
+    p.dirty = 1;
+    refresh_halo(&p);
+    return p;
+}
+
+// Copy the interior of a padded image out into a plain image.
+// padded_image p: image to copy.
+// returns: unpadded copy.
+image unpad_image(padded_image p)
+{
+    image im = make_image(p.w, p.h, p.c);
+    int k, j;
+    for(k = 0; k < p.c; ++k){
+        for(j = 0; j < p.h; ++j){
+            memcpy(im.data + k*p.w*p.h + j*p.w, padded_row(p, j, k), p.w*sizeof(float));
+        }
+    }
+    return im;
+}
+
+void free_padded_image(padded_image p)
+{
+    free(p.base);
+}
+
+// Refill the halo from the interior if it has been marked dirty.
+// Kernels that write the interior set dirty, kernels that read the halo
+// call this first, so images that are never read past the edge never pay.
+// padded_image *p: image to refresh.
+void refresh_halo(padded_image *p)
+{
+    if(!p->dirty) return;
+    int pad = p->pad;
+    int k, i, j;
+    for(k = 0; k < p->c; ++k){
+        for(j = 0; j < p->h; ++j){
+            float *row = padded_row(*p, j, k);
+            for(i = 1; i <= pad; ++i){
+                int l = border_index(-i, p->w, p->border);
+                int r = border_index(p->w - 1 + i, p->w, p->border);
+                row[-i] = l < 0 ? 0 : row[l];
+                row[p->w - 1 + i] = r < 0 ? 0 : row[r];
+            }
+        }
+        for(i = 1; i <= pad; ++i){
+            int rows[2] = {-i, p->h - 1 + i};
+            int n;
+            for(n = 0; n < 2; ++n){
+                float *dst = padded_row(*p, rows[n], k) - pad;
+                int src = border_index(rows[n], p->h, p->border);
+                if(src < 0) memset(dst, 0, (p->w + 2*pad)*sizeof(float));
+                else memcpy(dst, padded_row(*p, src, k) - pad, (p->w + 2*pad)*sizeof(float));
+            }
+        }
+    }
+    p->dirty = 0;
+}
+
+// Convolve a padded image with a filter, reading the halo instead of
+// clamping coordinates. Each output row accumulates one filter tap at a time
+// across the whole row, in the same order as convolve_image sums a pixel.
+// padded_image *im: image to convolve, its halo must be at least the
+//                   filter radius and is refreshed if dirty.
+// image filter: filter with odd width, 1 channel or im->c channels.
+// int preserve: keep all channels (1) or sum them into one (0).
+// returns: padded result with the same halo width and border, halo dirty.
+padded_image padded_convolve(padded_image *im, image filter, int preserve)
+{
+    assert(im->c == filter.c || filter.c == 1);
+    assert(filter.w % 2);
+    int cx = filter.w / 2, cy = filter.h / 2;
+    assert(cx <= im->pad && cy <= im->pad);
+    refresh_halo(im);
+    padded_image out = make_padded_image(im->w, im->h, preserve ? im->c : 1, im->pad, im->border);
+    int j;
+    #pragma omp parallel for
+    for(j = 0; j < im->h; ++j){
+        int c, fx, fy, i;
+        for(c = 0; c < im->c; ++c){
+            float *dst = padded_row(out, j, preserve ? c : 0);
+            const float *f = filter.data + (filter.c == 1 ? 0 : c)*filter.w*filter.h;
+            for(fy = 0; fy < filter.h; ++fy){
+                const float *src = padded_row(*im, j + fy - cy, c) - cx;
+                for(fx = 0; fx < filter.w; ++fx){
+                    float wt = f[fy*filter.w + fx];
+                    const float *s = src + fx;
+                    for(i = 0; i < im->w; ++i) dst[i] += s[i]*wt;
+                }
+            }
+        }
+    }
+    out.dirty = 1;
+    return out;
+}
@@ -0,0 +1,46 @@
+#ifndef PADDED_IMAGE_H
+#define PADDED_IMAGE_H
+#include "image.h"
+
+// How pixels outside the image are filled in.
+// BORDER_CLAMP:   aaa|abcd|ddd, same as get_pixel.
+// BORDER_REFLECT: cba|abcd|dcb
+// BORDER_ZERO:    000|abcd|000
+// BORDER_WRAP:    bcd|abcd|abc
+typedef enum{BORDER_CLAMP, BORDER_REFLECT, BORDER_ZERO, BORDER_WRAP} BORDER;
+
+// An image surrounded by a halo of pad pixels on every side, so kernels
+// that reach at most pad pixels away can index memory without clamping.
+// int w, h, c: size of the image inside the halo.
+// int pad: width of the halo.
+// int stride: floats between the starts of two rows, a multiple of 16.
+// int plane: floats between the starts of two channels.
+// BORDER border: how the halo is filled.
+// int dirty: the halo is stale and must be refreshed before it is read.
+// float *base: the allocation, 64 byte aligned.
+// float *data: pixel (0, 0) of channel 0, also 64 byte aligned.
+typedef struct{
+    int w, h, c;
+    int pad;
+    int stride, plane;
+    BORDER border;
+    int dirty;
+    float *base;
+    float *data;
+} padded_image;
+
+padded_image make_padded_image(int w, int h, int c, int pad, BORDER border);
+padded_image pad_image(image im, int pad, BORDER border);
+image unpad_image(padded_image p);
+void free_padded_image(padded_image p);
+void refresh_halo(padded_image *p);
+padded_image padded_convolve(padded_image *im, image filter, int preserve);
+
+// Pointer to the first interior pixel of row y in channel c.
+// Valid for -pad <= y < h + pad, and may be indexed from -pad to w + pad - 1.
+static inline float *padded_row(padded_image p, int y, int c)
+{
+    return p.data + c*p.plane + y*p.stride;
+}
+
+#endif
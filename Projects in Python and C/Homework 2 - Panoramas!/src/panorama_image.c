@@ -5,6 +5,10 @@
 #include <assert.h>
 #include "image.h"
 #include "matrix.h"
+#include "warp_image.h"
+#include "match_index.h"
+#include "descriptor_set.h"
+#include "ransac.h"
 
 #define FOREACH_PIXEL(IM, FUNC) \
 for (int j = 0; j < IM.h; ++j) { \
@@ -42,21 +46,8 @@ point make_point(float x, float y)
 image both_images(image a, image b)
 {
     image both = make_image(a.w + b.w, a.h > b.h ? a.h : b.h, a.c > b.c ? a.c : b.c);
-    int i,j,k;
-    for(k = 0; k < a.c; ++k){
-        for(j = 0; j < a.h; ++j){
-            for(i = 0; i < a.w; ++i){
-                set_pixel(both, i, j, k, get_pixel(a, i, j, k));
-            }
-        }
-    }
-    for(k = 0; k < b.c; ++k){
-        for(j = 0; j < b.h; ++j){
-            for(i = 0; i < b.w; ++i){
-                set_pixel(both, i+a.w, j, k, get_pixel(b, i, j, k));
-            }
-        }
-    }
+    paste_image(both, a, 0, 0);
+    paste_image(both, b, -a.w, 0);
     return both;
 }
 
@@ -133,48 +124,81 @@ float l1_distance(float *a, float *b, int n)
     return dist;
 }
 
-// Finds best matches between descriptors of two images.
+// Finds best matches between descriptors of two images, searching as
+// set by set_match_params.
 // descriptor *a, *b: array of descriptors for pixels in two images.
 // int an, bn: number of descriptors in arrays a and b.
 // int *mn: pointer to number of matches found, to be filled in by function.
 // returns: best matches found. each descriptor in a should match with at most
 //          one other descriptor in b.
 match *match_descriptors(descriptor *a, int an, descriptor *b, int bn, int *mn)
+{
+    return match_descriptors_params(a, an, b, bn, mn, get_match_params());
+}
+
+// What the descriptors of an array are, patches for an empty one.
+static DESCRIPTOR descriptor_kind(descriptor *d, int n)
+{
+    return n ? d[0].kind : DESCRIPTOR_PATCH;
+}
+
+// Same as match_descriptors with explicit matcher settings. Both arrays
+// must hold descriptors of the same kind and size, otherwise nothing is
+// matched.
+// match_params p: how to search for the nearest descriptor in b.
+match *match_descriptors_params(descriptor *a, int an, descriptor *b, int bn, int *mn, match_params p)
 {
     int i,j;
 
     // We will have at most an matches.
     *mn = an;
-    match *m = calloc(an, sizeof(match));
+    match *m = calloc(an ? an : 1, sizeof(match));
+    if(bn == 0){
+        *mn = 0;
+        return m;
+    }
+    DESCRIPTOR kind = descriptor_kind(a, an);
+    if(kind != descriptor_kind(b, bn) || (an && a[0].n != b[0].n)){
+        fprintf(stderr, "Cannot match descriptors of different kinds or sizes\n");
+        *mn = 0;
+        return m;
+    }
+    int *nearest = calloc(an ? an : 1, sizeof(int));
+    float *dist = calloc(an ? an : 1, sizeof(float));
+    float *second = calloc(an ? an : 1, sizeof(float));
+    if(kind == DESCRIPTOR_BRIEF){
+        // Binary descriptors are compared by Hamming distance, always
+        // exhaustively: it is cheap and the forest splits on float values.
+        hamming_nearest(a, an, b, bn, nearest, dist, second);
+    } else if(p.method == MATCH_KDFOREST){
+        match_index idx = make_match_index(b, bn, p.trees);
+        query_match_index(idx, a, an, p.checks, nearest, dist, second);
+        free_match_index(idx);
+    } else {
+        exact_nearest(a, an, b, bn, nearest, dist, second);
+    }
+    // Ratio test: a match barely better than the runner up is ambiguous.
+    int kept = 0;
     for(j = 0; j < an; ++j){
-        // TODO: for every descriptor in a, find best match in b.
-        // record ai as the index in *a and bi as the index in *b.
-        int bind = 0; // <- find the best match
-        float best = l1_distance(a[j].data, b[0].data, a[j].n);
-        for (int i = 1; i < bn; ++i) {
-            float d;
-            if ((d = l1_distance(a[j].data, b[i].data, a[j].n)) < best) {
-                bind = i;
-                best = d;
-            }
-        }
-        m[j].ai = j;
-        m[j].bi = bind; // <- should be index in b.
-        m[j].p = a[j].p;
-        m[j].q = b[bind].p;
-        m[j].distance = best; // <- should be the smallest L1 distance!
+        if(p.ratio > 0 && dist[j] > p.ratio*second[j]) continue;
+        m[kept].ai = j;
+        m[kept].bi = nearest[j];
+        m[kept].p = a[j].p;
+        m[kept].q = b[nearest[j]].p;
+        m[kept].distance = dist[j];
+        ++kept;
     }
+    an = kept;
+    free(nearest);
+    free(dist);
+    free(second);
 
     int count = 0;
     int *seen = calloc(bn, sizeof(int));
-    // TODO: we want matches to be injective (one-to-one).
-    // Sort matches based on distance using match_compare and qsort.
-    // Then throw out matches to the same element in b. Use seen to keep track.
-    // Each point should only be a part of one match.
-    // Some points will not be in a match.
-    // In practice just bring good matches to front of list, set *mn.
+    // Matches are injective (one-to-one): sort by distance, then drop later
+    // matches to the same element in b, keeping good matches at the front.
     qsort(m, an, sizeof(*m), &match_compare);
-    int* removed = (int*)calloc(an, sizeof(int));
+    int* removed = (int*)calloc(an ? an : 1, sizeof(int));
     for (i = 0; i < an; ++i) {
         if (!seen[m[i].bi]) {
             seen[m[i].bi] = 1;
@@ -194,22 +218,6 @@ match *match_descriptors(descriptor *a, int an, descriptor *b, int bn, int *mn)
     return m;
 }
 
-static point project_point_fast(matrix H, point p, matrix m)
-{
-    assert(m.cols == 1 && m.rows == 3);
-    assert(H.cols == 3 && H.rows == 3);
-    m.data[0][0] = p.x;
-    m.data[1][0] = p.y;
-    m.data[2][0] = 1;
-    matrix n = matrix_mult_matrix(H, m);
-    point r = {
-        .x = n.data[0][0] / n.data[2][0], 
-        .y = n.data[1][0] / n.data[2][0] 
-    };
-    free_matrix(n);
-    return r;
-}
-
 // Apply a projective transformation to a point.
 // matrix H: homography to project point.
 // point p: point to project.
@@ -219,15 +227,8 @@ point project_point(matrix H, point p)
     // TODO: project point p with homography H.
     // Remember that homogeneous coordinates are equivalent up to scalar.
     // Have to divide by.... something...
-    double arr[3];
-    double* data[3] = {&arr[0], &arr[1], &arr[2]};
-    matrix mat = {
-        .rows = 3, 
-        .cols = 1, 
-        .data = data
-    };
-    point r = project_point_fast(H, p, mat);
-    return r;
+    assert(H.cols == 3 && H.rows == 3);
+    return homography_project(make_homography(H), p);
 }
 
 // Calculate L2 distance between two points.
@@ -250,27 +251,16 @@ float point_distance(point p, point q)
 //          so that the inliers are first in the array. For drawing.
 int model_inliers(matrix H, match *m, int n, float thresh)
 {
-    int count = 0;
     // TODO: count number of matches that are inliers
     // i.e. distance(H*p, q) < thresh
     // Also, sort the matches m so the inliers are the first 'count' elements.
-    int j = n;
-    double arr[3];
-    double* data[3] = {&arr[0], &arr[1], &arr[2]};
-    matrix mat = {
-        .rows = 3, 
-        .cols = 1, 
-        .data = data
-    };
-    while(count < j) {
-        if (point_distance(project_point_fast(H, m[count].p, mat), m[count].q) < thresh) {
-            ++count;
-        } else {
-            match tmp = m[--j];
-            m[j] = m[count];
-            m[count] = tmp;
-        }
-    }
+    // Counted in bulk, then moved once.
+    match_coords c = make_match_coords(m, n);
+    unsigned char *mask = malloc(n / 8 + 1);
+    homography_inliers(make_homography(H), c, thresh, mask);
+    int count = order_inliers(m, n, mask);
+    free(mask);
+    free_match_coords(c);
     return count;
 }
 
@@ -295,86 +285,28 @@ void randomize_matches(match *m, int n)
 // returns: matrix representing homography H that maps image a to image b.
 matrix compute_homography(match *matches, int n)
 {
-    matrix M = make_matrix(n*2, 8);
-    matrix b = make_matrix(n*2, 1);
-
-    int i;
-    for(i = 0; i < n; ++i){
-        double x  = matches[i].p.x;
-        double xp = matches[i].q.x;
-        double y  = matches[i].p.y;
-        double yp = matches[i].q.y;
-        // TODO: fill in the matrices M and b.
-        double arr1[8] = {x, y, 1, 0, 0, 0, -x * xp, -y * xp};
-        double arr2[8] = {0, 0, 0, x, y, 1, -x * yp, -y * yp};
-        memcpy(M.data[i * 2], arr1, sizeof(arr1));
-        memcpy(M.data[i * 2 + 1], arr2, sizeof(arr2));
-        
-        b.data[i * 2][0] = xp;
-        b.data[i * 2 + 1][0] = yp;
-    }
-    matrix a = solve_system(M, b);
-    free_matrix(M); free_matrix(b); 
+    // Four matches determine the homography exactly, more are fit in the
+    // least squares sense. Both solvers work on the stack.
+    homography H;
+    int found = n == 4 ? solve_homography_4(matches, &H) : refit_homography(matches, n, &H);
 
     // If a solution can't be found, return empty matrix;
     matrix none = {0};
-    if(!a.data) return none;
-
-    matrix H = make_matrix(3, 3);
-    // TODO: fill in the homography H based on the result in a.
-    assert(a.cols == 1 && a.rows == 8);
-    for (i = 0; i < 8; ++i) {
-        H.data[i / 3][i % 3] =a.data[i][0];
-    }
-    H.data[2][2] = 1;
-
-    free_matrix(a);
-    return H;
+    if(!found) return none;
+    return homography_matrix(H);
 }
 
 // Perform RANdom SAmple Consensus to calculate homography for noisy matches.
 // match *m: set of matches.
 // int n: number of matches.
 // float thresh: inlier/outlier distance threshold.
-// int k: number of iterations to run.
+// int k: most iterations to run, fewer once the inliers found make it
+//        unlikely that more would find a better model.
 // int cutoff: inlier cutoff to exit early.
 // returns: matrix representing most common homography between matches.
 matrix RANSAC(match *m, int n, float thresh, int k, int cutoff)
 {
-    int best = 0;
-    matrix Hb = make_translation_homography(256, 0);
-    // TODO: fill in RANSAC algorithm.
-    // for k iterations:
-    //     shuffle the matches
-    //     compute a homography with a few matches (how many??)
-    //     if new homography is better than old (how can you tell?):
-    //         compute updated homography using all inliers
-    //         remember it and how good it is
-    //         if it's better than the cutoff:
-    //             return it immediately
-    // if we get to the end return the best homography
-    int fit_num = 4;
-    best = model_inliers(Hb, m, n, thresh);
-    if (best > cutoff) {
-        free_matrix(Hb);
-        return compute_homography(m, best);
-    }
-    for (int i = 0; i < k; ++i) {
-        randomize_matches(m, n);
-        matrix H = compute_homography(m, fit_num);
-        int inliners = model_inliers(H, m, n, thresh);
-        if (inliners > best) {
-            free_matrix(Hb);
-            Hb = compute_homography(m, inliners);
-            best = inliners;
-            if (best > cutoff) {
-                return Hb;
-            }
-        } else {
-            free_matrix(H);
-        }
-    }
-    return Hb;
+    return RANSAC_params(m, n, thresh, k, cutoff, get_ransac_params(), 0);
 }
 
 // Stitches two images together using a projective transformation.
@@ -411,41 +343,15 @@ image combine_images(image a, image b, matrix H)
     //     return copy_image(a);
     // }
 
-    int i,j,k;
     image c = make_image(w, h, a.c);
     
     // Paste image a into the new image offset by dx and dy.
-    for(k = 0; k < a.c; ++k){
-        for(j = 0; j < a.h; ++j){
-            for(i = 0; i < a.w; ++i){
-                // TODO: fill in.
-                set_pixel(c, i - dx, j - dy, k, get_pixel(a, i, j, k));
-            }
-        }
-    }
+    paste_image(c, a, dx, dy);
 
-    // TODO: Paste in image b as well.
-    // You should loop over some points in the new image (which? all?)
-    // and see if their projection from a coordinates to b coordinates falls
-    // inside of the bounds of image b. If so, use bilinear interpolation to
-    // estimate the value of b at that projection, then fill in image c.
-    double arr[3];
-    double* data[3] = {&arr[0], &arr[1], &arr[2]};
-    matrix mat = {
-        .rows = 3, 
-        .cols = 1, 
-        .data = data
-    };
-    for (k = 0; k < a.c; ++k) {
-        for (j = topleft.y; j < botright.y; ++j) {
-            for (i = topleft.x; i < botright.x; ++i) {
-                point p = project_point_fast(H, make_point(i, j), mat);
-                if (p.x >= 0 && p.x < b.w && p.y >= 0 && p.y < b.h) {
-                    set_pixel(c, i - dx, j - dy, k, bilinear_interpolate(b, p.x, p.y, k));
-                }
-            }
-        }
-    }
+    // Paste in image b as well. Every canvas pixel inside the bounds of b
+    // warped into a coordinates is projected into b and bilinearly sampled.
+    warp_image_into(c, b, make_homography(H), dx, dy, topleft, botright);
+    free_matrix(Hinv);
     return c;
 }
 
@@ -471,8 +377,11 @@ image panorama_image(image a, image b, float sigma, float thresh, int nms, float
     // Find matches
     match *m = match_descriptors(ad, an, bd, bn, &mn);
 
-    // Run RANSAC to find the homography
-    matrix H = RANSAC(m, mn, inlier_thresh, iters, cutoff);
+    // Run RANSAC to find the homography. The matches are sorted by
+    // distance, so the best are sampled first.
+    ransac_params p = get_ransac_params();
+    p.prosac = 1;
+    matrix H = RANSAC_params(m, mn, inlier_thresh, iters, cutoff, p, 0);
 
     if(0){
         // Mark corners and matches between images
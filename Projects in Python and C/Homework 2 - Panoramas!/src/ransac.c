@@ -0,0 +1,632 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <stdatomic.h>
+#include <unistd.h>
+#include "image.h"
+#include "matrix.h"
+#include "warp_image.h"
+#include "ransac.h"
+
+// Matches needed to fit a homography.
+#define RANSAC_SAMPLE 4
+// Samples with three points closer to a line than this, as twice the area
+// of their triangle in normalized coordinates, are not solved.
+#define RANSAC_COLLINEAR 1e-3
+// Iterations each thread draws between comparing results with the others.
+#define RANSAC_ROUND 32
+// Matches counted between checks that a hypothesis can still win.
+#define RANSAC_BLOCK 64
+
+static ransac_params ransac = {.99, 0, 1, 0};
+
+// Choose how RANSAC samples and stops, for every later call.
+void set_ransac_params(ransac_params p)
+{
+    ransac = p;
+}
+
+ransac_params get_ransac_params()
+{
+    return ransac;
+}
+
+// Iterations needed to draw one sample of only inliers with a given
+// confidence, log(1 - confidence) / log(1 - ratio^4).
+// float ratio: fraction of matches that are inliers.
+// float confidence: probability wanted, 0 for no early stop.
+// int k: most iterations to run.
+// returns: iterations to run, at most k.
+int ransac_iterations(float ratio, float confidence, int k)
+{
+    double p = pow(ratio, RANSAC_SAMPLE);
+    if(confidence <= 0 || p <= 0) return k;
+    if(p >= 1) return MIN(1, k);
+    double t = ceil(log(1 - confidence) / log(1 - p));
+    return t < k ? (int)t : k;
+}
+
+// Private xorshift generator so a RANSAC run draws one value from rand().
+static inline unsigned next_random(unsigned *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+// Uniform integer in [0, n).
+static inline int random_below(unsigned *s, int n)
+{
+    return (int)(((unsigned long long)next_random(s) * n) >> 32);
+}
+
+// Fill idx[from..RANSAC_SAMPLE) with distinct indices in [0, n) that are
+// not already in idx[0..from).
+static void draw_distinct(int *idx, int from, int n, unsigned *s)
+{
+    int i, j;
+    for(i = from; i < RANSAC_SAMPLE; ++i){
+        int again;
+        do{
+            idx[i] = random_below(s, n);
+            again = 0;
+            for(j = 0; j < i; ++j) again |= idx[j] == idx[i];
+        } while(again);
+    }
+}
+
+// PROSAC schedule (Chum and Matas, 2005). Samples come from the best size
+// matches and always include the newest of them. size grows at the rate
+// that, by iteration k, each match has been in as many samples as under
+// uniform sampling, after which all matches are drawn from uniformly.
+typedef struct{
+    int size;
+    double tn;
+    double grow_at;
+} prosac_schedule;
+
+static prosac_schedule make_prosac(int n, int k)
+{
+    prosac_schedule s;
+    s.size = RANSAC_SAMPLE;
+    s.tn = k;
+    int i;
+    for(i = 0; i < RANSAC_SAMPLE; ++i) s.tn *= (double)(RANSAC_SAMPLE - i) / (n - i);
+    s.grow_at = 1;
+    return s;
+}
+
+// Draw the sample for iteration t, counting from 1.
+static void prosac_sample(prosac_schedule *s, int t, int n, int *idx, unsigned *seed)
+{
+    while(s->size < n && t > s->grow_at){
+        ++s->size;
+        double next = s->tn * s->size / (s->size - RANSAC_SAMPLE);
+        s->grow_at += ceil(next - s->tn);
+        s->tn = next;
+    }
+    if(s->size < n){
+        idx[0] = s->size - 1;
+        draw_distinct(idx, 1, s->size - 1, seed);
+    } else {
+        draw_distinct(idx, 0, n, seed);
+    }
+}
+
+// A scale and shift, x' = s*x + tx, y' = s*y + ty.
+typedef struct{
+    double s, tx, ty;
+} similarity;
+
+// Similarity that moves one side of a set of matches to its centroid with
+// an average distance of sqrt(2) from it (Hartley), so the homography
+// equations stay well conditioned whatever the pixel coordinates.
+// int side: 0 for the p points, 1 for the q points.
+static similarity normalizing(const match *m, int n, int side)
+{
+    double cx = 0, cy = 0, d = 0;
+    int i;
+    for(i = 0; i < n; ++i){
+        point a = side ? m[i].q : m[i].p;
+        cx += a.x;
+        cy += a.y;
+    }
+    cx /= n;
+    cy /= n;
+    for(i = 0; i < n; ++i){
+        point a = side ? m[i].q : m[i].p;
+        d += sqrt((a.x - cx)*(a.x - cx) + (a.y - cy)*(a.y - cy));
+    }
+    similarity t;
+    t.s = d > 0 ? sqrt(2)*n / d : 1;
+    t.tx = -t.s*cx;
+    t.ty = -t.s*cy;
+    return t;
+}
+
+// The two DLT equations of one normalized match, as rows of [A | b] for
+// the 8 unknowns of a homography with h22 = 1.
+static inline void homography_rows(const match *m, similarity a, similarity b, double r[2][9])
+{
+    double x = a.s*m->p.x + a.tx, y = a.s*m->p.y + a.ty;
+    double xp = b.s*m->q.x + b.tx, yp = b.s*m->q.y + b.ty;
+    double r0[9] = {x, y, 1, 0, 0, 0, -x*xp, -y*xp, xp};
+    double r1[9] = {0, 0, 0, x, y, 1, -x*yp, -y*yp, yp};
+    memcpy(r[0], r0, sizeof(r0));
+    memcpy(r[1], r1, sizeof(r1));
+}
+
+// Undo the normalization: H = B^-1 Hn A, scaled so h22 = 1.
+// returns: 0 if h22 vanishes.
+static int denormalize(const double *h, similarity a, similarity b, homography *H)
+{
+    double hn[3][3] = {{h[0], h[1], h[2]}, {h[3], h[4], h[5]}, {h[6], h[7], 1}};
+    double r[3][3];
+    int i, j;
+    for(i = 0; i < 3; ++i){
+        double m0 = hn[i][0]*a.s, m1 = hn[i][1]*a.s;
+        double m2 = hn[i][0]*a.tx + hn[i][1]*a.ty + hn[i][2];
+        r[i][0] = m0; r[i][1] = m1; r[i][2] = m2;
+    }
+    for(j = 0; j < 3; ++j){
+        r[0][j] = (r[0][j] - b.tx*r[2][j]) / b.s;
+        r[1][j] = (r[1][j] - b.ty*r[2][j]) / b.s;
+    }
+    if(fabs(r[2][2]) < 1e-12) return 0;
+    for(i = 0; i < 3; ++i){
+        for(j = 0; j < 3; ++j){
+            H->h[i][j] = r[i][j] / r[2][2];
+        }
+    }
+    return 1;
+}
+
+// Whether any three of four points are nearly on a line, which leaves the
+// homography through them undetermined. Points are normalized, so one
+// threshold on twice the triangle area fits every image size.
+static int collinear(const match *m, similarity t, int side)
+{
+    static const int triangles[4][3] = {{1, 2, 3}, {0, 2, 3}, {0, 1, 3}, {0, 1, 2}};
+    double x[4], y[4];
+    int i;
+    for(i = 0; i < 4; ++i){
+        point p = side ? m[i].q : m[i].p;
+        x[i] = t.s*p.x + t.tx;
+        y[i] = t.s*p.y + t.ty;
+    }
+    for(i = 0; i < 4; ++i){
+        int a = triangles[i][0], b = triangles[i][1], c = triangles[i][2];
+        double cross = (x[b] - x[a])*(y[c] - y[a]) - (y[b] - y[a])*(x[c] - x[a]);
+        if(fabs(cross) < RANSAC_COLLINEAR) return 1;
+    }
+    return 0;
+}
+
+// Homography through exactly four matches, with no heap storage: the 8x9
+// DLT system is solved by Gaussian elimination with partial pivoting.
+// match *m: four matches.
+// homography *H: filled with the homography mapping p to q.
+// returns: 1 on success, 0 if three points on either side are nearly
+//          collinear or the system is singular.
+int solve_homography_4(match *m, homography *H)
+{
+    similarity a = normalizing(m, 4, 0), b = normalizing(m, 4, 1);
+    if(collinear(m, a, 0) || collinear(m, b, 1)) return 0;
+    double s[8][9];
+    int i, j, k;
+    for(i = 0; i < 4; ++i) homography_rows(m + i, a, b, s + 2*i);
+    for(k = 0; k < 8; ++k){
+        int pivot = k;
+        for(i = k + 1; i < 8; ++i){
+            if(fabs(s[i][k]) > fabs(s[pivot][k])) pivot = i;
+        }
+        if(fabs(s[pivot][k]) < 1e-10) return 0;
+        if(pivot != k){
+            double row[9];
+            memcpy(row, s[k], sizeof(row));
+            memcpy(s[k], s[pivot], sizeof(row));
+            memcpy(s[pivot], row, sizeof(row));
+        }
+        for(i = k + 1; i < 8; ++i){
+            double f = s[i][k] / s[k][k];
+            for(j = k; j < 9; ++j) s[i][j] -= f*s[k][j];
+        }
+    }
+    double h[8];
+    for(k = 7; k >= 0; --k){
+        double v = s[k][8];
+        for(j = k + 1; j < 8; ++j) v -= s[k][j]*h[j];
+        h[k] = v / s[k][k];
+    }
+    return denormalize(h, a, b, H);
+}
+
+// Least squares homography through any number of matches, from the normal
+// equations accumulated in place and solved by Cholesky, with no heap
+// storage.
+// match *m: matches to fit, at least four.
+// int n: number of matches.
+// homography *H: filled with the homography mapping p to q.
+// returns: 1 on success, 0 if the normal equations are singular.
+int refit_homography(match *m, int n, homography *H)
+{
+    if(n < 4) return 0;
+    similarity a = normalizing(m, n, 0), b = normalizing(m, n, 1);
+    double A[8][8] = {{0}}, y[8] = {0};
+    int i, j, k, r;
+    for(i = 0; i < n; ++i){
+        double rows[2][9];
+        homography_rows(m + i, a, b, rows);
+        for(r = 0; r < 2; ++r){
+            for(j = 0; j < 8; ++j){
+                y[j] += rows[r][j]*rows[r][8];
+                for(k = 0; k <= j; ++k) A[j][k] += rows[r][j]*rows[r][k];
+            }
+        }
+    }
+    // A = L L^T, with L stored in the lower triangle of A.
+    for(j = 0; j < 8; ++j){
+        double d = A[j][j];
+        for(k = 0; k < j; ++k) d -= A[j][k]*A[j][k];
+        if(d <= 1e-12) return 0;
+        A[j][j] = sqrt(d);
+        for(i = j + 1; i < 8; ++i){
+            double v = A[i][j];
+            for(k = 0; k < j; ++k) v -= A[i][k]*A[j][k];
+            A[i][j] = v / A[j][j];
+        }
+    }
+    double h[8];
+    for(i = 0; i < 8; ++i){
+        double v = y[i];
+        for(k = 0; k < i; ++k) v -= A[i][k]*h[k];
+        h[i] = v / A[i][i];
+    }
+    for(i = 7; i >= 0; --i){
+        double v = h[i];
+        for(k = i + 1; k < 8; ++k) v -= A[k][i]*h[k];
+        h[i] = v / A[i][i];
+    }
+    return denormalize(h, a, b, H);
+}
+
+// Copy the coordinates of a set of matches into separate arrays.
+// match *m: matches to copy.
+// int n: number of matches.
+// returns: the coordinates, free with free_match_coords.
+match_coords make_match_coords(match *m, int n)
+{
+    match_coords c;
+    int stride = (n + INLIER_LANES - 1) / INLIER_LANES * INLIER_LANES;
+    size_t bytes = (stride ? stride : INLIER_LANES)*sizeof(float);
+    float *block = aligned_alloc(32, 4*bytes);
+    memset(block, 0, 4*bytes);
+    c.n = n;
+    c.px = block;
+    c.py = c.px + bytes / sizeof(float);
+    c.qx = c.py + bytes / sizeof(float);
+    c.qy = c.qx + bytes / sizeof(float);
+    int i;
+    for(i = 0; i < n; ++i){
+        c.px[i] = m[i].p.x;
+        c.py[i] = m[i].p.y;
+        c.qx[i] = m[i].q.x;
+        c.qy[i] = m[i].q.y;
+    }
+    return c;
+}
+
+void free_match_coords(match_coords c)
+{
+    free(c.px);
+}
+
+// Which of the INLIER_LANES matches starting at i are inliers. With
+// (x, y, w) = H p, a match is an inlier if |(x, y) - w q|^2 < t2 w^2, the
+// squared reprojection distance scaled by w^2, so neither a division nor
+// a square root is needed.
+// const float *h: the homography, row-major.
+// returns: one bit per match, lowest for match i. Lanes past c.n are zero
+//          padding and must be masked off.
+static inline int inlier_bits(const float *h, match_coords c, int i, float t2)
+{
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 px = _mm256_load_ps(c.px + i), py = _mm256_load_ps(c.py + i);
+    __m256 x = _mm256_fmadd_ps(_mm256_set1_ps(h[0]), px, _mm256_fmadd_ps(_mm256_set1_ps(h[1]), py, _mm256_set1_ps(h[2])));
+    __m256 y = _mm256_fmadd_ps(_mm256_set1_ps(h[3]), px, _mm256_fmadd_ps(_mm256_set1_ps(h[4]), py, _mm256_set1_ps(h[5])));
+    __m256 w = _mm256_fmadd_ps(_mm256_set1_ps(h[6]), px, _mm256_fmadd_ps(_mm256_set1_ps(h[7]), py, _mm256_set1_ps(h[8])));
+    __m256 dx = _mm256_fnmadd_ps(w, _mm256_load_ps(c.qx + i), x);
+    __m256 dy = _mm256_fnmadd_ps(w, _mm256_load_ps(c.qy + i), y);
+    __m256 d = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+    __m256 lim = _mm256_mul_ps(_mm256_mul_ps(w, w), _mm256_set1_ps(t2));
+    return _mm256_movemask_ps(_mm256_cmp_ps(d, lim, _CMP_LT_OQ));
+#elif defined(__SSE2__)
+    int j, bits = 0;
+    for(j = 0; j < INLIER_LANES; j += 4){
+        __m128 px = _mm_load_ps(c.px + i + j), py = _mm_load_ps(c.py + i + j);
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h[0]), px), _mm_mul_ps(_mm_set1_ps(h[1]), py)), _mm_set1_ps(h[2]));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h[3]), px), _mm_mul_ps(_mm_set1_ps(h[4]), py)), _mm_set1_ps(h[5]));
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(h[6]), px), _mm_mul_ps(_mm_set1_ps(h[7]), py)), _mm_set1_ps(h[8]));
+        __m128 dx = _mm_sub_ps(x, _mm_mul_ps(w, _mm_load_ps(c.qx + i + j)));
+        __m128 dy = _mm_sub_ps(y, _mm_mul_ps(w, _mm_load_ps(c.qy + i + j)));
+        __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 lim = _mm_mul_ps(_mm_mul_ps(w, w), _mm_set1_ps(t2));
+        bits |= _mm_movemask_ps(_mm_cmplt_ps(d, lim)) << j;
+    }
+    return bits;
+#else
+    int j, bits = 0;
+    for(j = 0; j < INLIER_LANES; ++j){
+        float px = c.px[i + j], py = c.py[i + j];
+        float x = h[0]*px + h[1]*py + h[2];
+        float y = h[3]*px + h[4]*py + h[5];
+        float w = h[6]*px + h[7]*py + h[8];
+        float dx = x - w*c.qx[i + j], dy = y - w*c.qy[i + j];
+        bits |= (dx*dx + dy*dy < t2*w*w) << j;
+    }
+    return bits;
+#endif
+}
+
+static void homography_floats(homography H, float *h)
+{
+    int i, j;
+    for(i = 0; i < 3; ++i){
+        for(j = 0; j < 3; ++j) h[3*i + j] = H.h[i][j];
+    }
+}
+
+// Bits of the matches in block i that exist.
+static inline int lanes_in(int n, int i)
+{
+    return n - i >= INLIER_LANES ? (1 << INLIER_LANES) - 1 : (1 << (n - i)) - 1;
+}
+
+// Count inliers of a homography without moving any match.
+// homography H: homography from p to q.
+// match_coords c: the matches.
+// float thresh: inlier/outlier distance threshold.
+// unsigned char *mask: if not null, filled with one bit per match, set for
+//                      inliers, match i in bit i%8 of byte i/8.
+// returns: number of inliers.
+int homography_inliers(homography H, match_coords c, float thresh, unsigned char *mask)
+{
+    float h[9];
+    homography_floats(H, h);
+    int i, count = 0;
+    for(i = 0; i < c.n; i += INLIER_LANES){
+        int bits = inlier_bits(h, c, i, thresh*thresh) & lanes_in(c.n, i);
+        if(mask) mask[i / INLIER_LANES] = bits;
+        count += __builtin_popcount(bits);
+    }
+    return count;
+}
+
+// Move the inliers of a mask to the front, each side keeping its order.
+// match *m: matches to reorder.
+// int n: number of matches.
+// const unsigned char *mask: inliers, as from homography_inliers.
+// returns: number of inliers.
+int order_inliers(match *m, int n, const unsigned char *mask)
+{
+    match *out = malloc((n ? n : 1)*sizeof(match));
+    int i, in = 0, o = 0, count = 0;
+    for(i = 0; i < n; ++i) count += mask[i / 8] >> (i % 8) & 1;
+    for(i = 0; i < n; ++i){
+        if(mask[i / 8] >> (i % 8) & 1) out[in++] = m[i];
+        else out[count + o++] = m[i];
+    }
+    memcpy(m, out, n*sizeof(match));
+    free(out);
+    return count;
+}
+
+// Count inliers like homography_inliers, but give up once the matches
+// left could not bring the count up to floor.
+// returns: the count, or something below floor if it could not reach it.
+static int count_inliers_above(homography H, match_coords c, float thresh, int floor)
+{
+    float h[9];
+    homography_floats(H, h);
+    float t2 = thresh*thresh;
+    int i, j, count = 0;
+    for(i = 0; i < c.n; i += RANSAC_BLOCK){
+        if(count + c.n - i < floor) return count;
+        int end = MIN(i + RANSAC_BLOCK, c.n);
+        for(j = i; j < end; j += INLIER_LANES){
+            count += __builtin_popcount(inlier_bits(h, c, j, t2) & lanes_in(c.n, j));
+        }
+    }
+    return count;
+}
+
+// Best hypothesis one worker has drawn. ordinal is the iteration that drew
+// it, 0 for the starting translation, and breaks ties so the result does
+// not depend on which thread finished first.
+typedef struct{
+    int inliers;
+    int ordinal;
+    int drawn;
+    homography H;
+} ransac_best;
+
+// State shared by the workers of one RANSAC run. Workers draw round
+// hypotheses each per round, then meet at the barrier, where every one of
+// them merges the bests in slot the same way and so agrees on how many
+// iterations are needed and whether to stop.
+typedef struct{
+    match *m;
+    match_coords c;
+    int n, k, cutoff;
+    float thresh;
+    ransac_params p;
+    int threads, round;
+    ransac_best start;
+    ransac_best *slot[2];
+    atomic_int best;
+    pthread_barrier_t barrier;
+    ransac_best result;
+} ransac_run;
+
+typedef struct{
+    ransac_run *run;
+    int w;
+} ransac_worker_args;
+
+// Seed of worker w's stream, so streams differ for every worker and seed.
+static unsigned stream_seed(unsigned seed, int w)
+{
+    unsigned long long z = seed + 0x9e3779b97f4a7c15ULL*(w + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (unsigned)z | 1;
+}
+
+static int better(ransac_best a, ransac_best b)
+{
+    return a.inliers > b.inliers || (a.inliers == b.inliers && a.ordinal < b.ordinal);
+}
+
+// Iterations worker w draws: from round r, the ordinals
+// r*threads*round + w*round + 1 onwards, up to needed.
+static void *ransac_worker(void *ptr)
+{
+    ransac_worker_args *args = ptr;
+    ransac_run *r = args->run;
+    int w = args->w, n = r->n, T = r->threads, B = r->round;
+    unsigned seed = stream_seed(r->p.seed, w);
+    prosac_schedule schedule = make_prosac(n, r->k);
+    ransac_best mine = r->start;
+    mine.drawn = 0;
+    int needed = ransac_iterations((float)r->start.inliers / n, r->p.confidence, r->k);
+    int round, t, j;
+    for(round = 0; ; ++round){
+        int first = round*T*B + w*B + 1;
+        int last = MIN(first + B - 1, needed);
+        for(t = first; t <= last; ++t){
+            int idx[RANSAC_SAMPLE];
+            match sample[RANSAC_SAMPLE];
+            if(r->p.prosac) prosac_sample(&schedule, t, n, idx, &seed);
+            else draw_distinct(idx, 0, n, &seed);
+            ++mine.drawn;
+            for(j = 0; j < RANSAC_SAMPLE; ++j) sample[j] = r->m[idx[j]];
+            homography H;
+            if(!solve_homography_4(sample, &H)) continue;
+            // Hypotheses tying the shared best are still counted: one of
+            // them may win the tie on ordinal.
+            int floor = MAX(mine.inliers + 1, atomic_load_explicit(&r->best, memory_order_relaxed));
+            int inliers = count_inliers_above(H, r->c, r->thresh, floor);
+            if(inliers < floor) continue;
+            mine.inliers = inliers;
+            mine.ordinal = t;
+            mine.H = H;
+            int seen = atomic_load_explicit(&r->best, memory_order_relaxed);
+            while(seen < inliers && !atomic_compare_exchange_weak(&r->best, &seen, inliers));
+        }
+        ransac_best *slot = r->slot[round & 1];
+        slot[w] = mine;
+        if(T > 1) pthread_barrier_wait(&r->barrier);
+        ransac_best merged = slot[0];
+        int drawn = 0;
+        for(j = 0; j < T; ++j){
+            if(better(slot[j], merged)) merged = slot[j];
+            drawn += slot[j].drawn;
+        }
+        merged.drawn = drawn;
+        if(merged.inliers <= r->cutoff){
+            needed = ransac_iterations((float)merged.inliers / n, r->p.confidence, r->k);
+        }
+        if(merged.inliers > r->cutoff || (round + 1)*T*B >= needed){
+            if(w == 0) r->result = merged;
+            break;
+        }
+    }
+    return 0;
+}
+
+// Run the workers, the calling thread being worker 0.
+static ransac_best run_workers(ransac_run *r)
+{
+    int T = r->threads, i;
+    r->slot[0] = calloc(2*T, sizeof(ransac_best));
+    r->slot[1] = r->slot[0] + T;
+    atomic_init(&r->best, r->start.inliers + 1);
+    ransac_worker_args *args = calloc(T, sizeof(ransac_worker_args));
+    pthread_t *thread = calloc(T, sizeof(pthread_t));
+    if(T > 1) pthread_barrier_init(&r->barrier, 0, T);
+    for(i = 0; i < T; ++i){
+        args[i].run = r;
+        args[i].w = i;
+        if(i) pthread_create(thread + i, 0, ransac_worker, args + i);
+    }
+    ransac_worker(args);
+    for(i = 1; i < T; ++i) pthread_join(thread[i], 0);
+    if(T > 1) pthread_barrier_destroy(&r->barrier);
+    free(thread);
+    free(args);
+    free(r->slot[0]);
+    return r->result;
+}
+
+// RANSAC for a homography, with explicit sampling and stopping settings.
+// Samples are 4 indices into m, which keeps its order until the end so
+// PROSAC can rely on it. With several threads, each draws from its own
+// stream and they compare results every RANSAC_ROUND iterations, so the
+// same seed and number of threads always give the same homography.
+// match *m: set of matches, inliers of the result are moved to the front.
+// int n: number of matches.
+// float thresh: inlier/outlier distance threshold.
+// int k: most iterations to run.
+// int cutoff: inlier cutoff to exit early.
+// ransac_params p: how to sample, stop and split the work.
+// int *used: if not null, filled with the number of samples drawn.
+// returns: matrix representing most common homography between matches.
+matrix RANSAC_params(match *m, int n, float thresh, int k, int cutoff, ransac_params p, int *used)
+{
+    matrix T = make_translation_homography(256, 0);
+    homography Hb = make_homography(T);
+    free_matrix(T);
+    match_coords c = make_match_coords(m, n);
+    unsigned char *mask = malloc(n / 8 + 1);
+    ransac_best best = {homography_inliers(Hb, c, thresh, 0), 0, 0, Hb};
+    if(best.inliers <= cutoff && n >= RANSAC_SAMPLE && k > 0){
+        ransac_run r;
+        r.m = m;
+        r.c = c;
+        r.n = n;
+        r.k = k;
+        r.cutoff = cutoff;
+        r.thresh = thresh;
+        r.p = p;
+        if(!r.p.seed) r.p.seed = rand();
+        r.threads = p.threads > 0 ? p.threads : sysconf(_SC_NPROCESSORS_ONLN);
+        r.threads = MAX(1, MIN(r.threads, (k + RANSAC_ROUND - 1) / RANSAC_ROUND));
+        r.round = r.threads > 1 ? RANSAC_ROUND : 1;
+        r.start = best;
+        best = run_workers(&r);
+    }
+    // Refit to every inlier of the winner, gathered in a copy so m only
+    // moves once, for the final model.
+    Hb = best.H;
+    if(best.ordinal || best.inliers > cutoff){
+        match *fit = malloc((n ? n : 1)*sizeof(match));
+        memcpy(fit, m, n*sizeof(match));
+        homography_inliers(best.H, c, thresh, mask);
+        int inliers = order_inliers(fit, n, mask);
+        if(!refit_homography(fit, inliers, &Hb)) Hb = best.H;
+        free(fit);
+    }
+    if(used) *used = best.drawn;
+    // Inliers of the result first, for drawing.
+    homography_inliers(Hb, c, thresh, mask);
+    order_inliers(m, n, mask);
+    free(mask);
+    free_match_coords(c);
+    return homography_matrix(Hb);
+}
@@ -0,0 +1,50 @@
+#ifndef RANSAC_H
+#define RANSAC_H
+#include "image.h"
+#include "matrix.h"
+#include "warp_image.h"
+
+// How RANSAC draws samples and when it stops.
+// float confidence: stop once a sample of only inliers has been drawn with
+//                   this probability, judged by the best inlier ratio so
+//                   far. 0 runs every iteration.
+// int prosac: draw from the best matches first and widen to all of them
+//             (PROSAC). Off by default, since it only helps matches sorted
+//             by descriptor distance, as match_descriptors returns them.
+// int threads: threads drawing hypotheses, 0 for one per core. A run is
+//              reproducible for a given seed and number of threads.
+// unsigned seed: seed of the random streams, 0 to take one from rand().
+typedef struct{
+    float confidence;
+    int prosac;
+    int threads;
+    unsigned seed;
+} ransac_params;
+
+// Matches as separate coordinate arrays, so inliers of a homography are
+// counted INLIER_LANES at a time.
+// int n: number of matches.
+// float *px, *py, *qx, *qy: coordinates of each side of the matches,
+//                           allocated to a multiple of INLIER_LANES.
+#define INLIER_LANES 8
+typedef struct{
+    int n;
+    float *px, *py, *qx, *qy;
+} match_coords;
+
+match_coords make_match_coords(match *m, int n);
+void free_match_coords(match_coords c);
+int homography_inliers(homography H, match_coords c, float thresh, unsigned char *mask);
+int order_inliers(match *m, int n, const unsigned char *mask);
+
+void set_ransac_params(ransac_params p);
+ransac_params get_ransac_params();
+int ransac_iterations(float ratio, float confidence, int k);
+
+int solve_homography_4(match *m, homography *H);
+int refit_homography(match *m, int n, homography *H);
+matrix compute_homography(match *matches, int n);
+matrix RANSAC(match *m, int n, float thresh, int k, int cutoff);
+matrix RANSAC_params(match *m, int n, float thresh, int k, int cutoff, ransac_params p, int *used);
+
+#endif
@@ -2,10 +2,17 @@
 #include <math.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 #include "matrix.h"
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "warp_image.h"
+#include "gaussian_image.h"
+#include "padded_image.h"
+#include "match_index.h"
+#include "descriptor_set.h"
+#include "ransac.h"
 
 int tests_total = 0;
 int tests_fail = 0;
@@ -370,6 +377,601 @@ void test_cornerness()
     free_image(gt);
 }
 
+void test_padded_image()
+{
+    image im = make_image(3, 2, 1);
+    int i;
+    for(i = 0; i < 6; ++i) im.data[i] = i + 1;
+    // Row 0 is 1 2 3, row 1 is 4 5 6. Check the halo left of and above (0,0).
+    padded_image c = pad_image(im, 2, BORDER_CLAMP);
+    padded_image r = pad_image(im, 2, BORDER_REFLECT);
+    padded_image z = pad_image(im, 2, BORDER_ZERO);
+    padded_image w = pad_image(im, 2, BORDER_WRAP);
+    TEST(within_eps(padded_row(c, 0, 0)[-2], 1) && within_eps(padded_row(c, 0, 0)[4], 3));
+    TEST(within_eps(padded_row(r, 0, 0)[-2], 2) && within_eps(padded_row(r, 0, 0)[4], 2));
+    TEST(within_eps(padded_row(z, 0, 0)[-1], 0) && within_eps(padded_row(z, -1, 0)[1], 0));
+    TEST(within_eps(padded_row(w, 0, 0)[-1], 3) && within_eps(padded_row(w, -1, 0)[0], 4));
+    TEST(within_eps(padded_row(r, -2, 0)[-1], 4));
+    TEST(((size_t)c.data & 63) == 0 && c.stride % 16 == 0);
+
+    image u = unpad_image(c);
+    TEST(same_image(u, im));
+    free_image(u);
+    free_padded_image(c);
+    free_padded_image(r);
+    free_padded_image(z);
+    free_padded_image(w);
+    free_image(im);
+}
+
+void test_smooth_image()
+{
+    image im = load_image("data/dog.jpg");
+    image f = make_gaussian_filter(2);
+    l1_normalize(f);
+    image full = convolve_image(im, f, 1);
+    image sep = gaussian_blur(im, 2, GAUSSIAN_SEPARABLE);
+    TEST(same_image(sep, full));
+
+    // The recursive filter approximates the kernel, compare on average.
+    image exact = gaussian_blur(im, 8, GAUSSIAN_SEPARABLE);
+    image rec = gaussian_blur(im, 8, GAUSSIAN_RECURSIVE);
+    int i;
+    float err = 0;
+    for(i = 0; i < im.w*im.h*im.c; ++i) err += fabs(exact.data[i] - rec.data[i]);
+    err /= im.w*im.h*im.c;
+    TEST(err < EPS);
+    free_image(im);
+    free_image(f);
+    free_image(full);
+    free_image(sep);
+    free_image(exact);
+    free_image(rec);
+}
+
+void test_combine_images()
+{
+    image a = load_image("data/dogsmall.jpg");
+    image b = load_image("data/dog.jpg");
+    matrix H = make_translation_homography(-40.5, -20.25);
+    H.data[0][0] = 1.1;
+    H.data[2][0] = .0004;
+    image c = combine_images(a, b, H);
+    homography h = make_homography(H);
+    int i, j, k;
+    int bad = 0, warped = 0;
+    point q;
+    // a is pasted at the origin since b lands to its bottom right.
+    for(j = 0; j < c.h; ++j){
+        for(i = 0; i < c.w; ++i){
+            q.x = i; q.y = j;
+            point p = homography_project(h, q);
+            if(p.x >= 0 && p.x < b.w && p.y >= 0 && p.y < b.h){
+                ++warped;
+                for(k = 0; k < c.c; ++k){
+                    if(!within_eps(get_pixel(c, i, j, k), bilinear_interpolate(b, p.x, p.y, k))) ++bad;
+                }
+            } else if(i < a.w && j < a.h){
+                for(k = 0; k < c.c; ++k){
+                    if(!within_eps(get_pixel(c, i, j, k), get_pixel(a, i, j, k))) ++bad;
+                }
+            }
+        }
+    }
+    TEST(warped > 0);
+    TEST(bad == 0);
+    free_matrix(H);
+    free_image(a);
+    free_image(b);
+    free_image(c);
+}
+
+// Random descriptors, and queries that are noisy copies of every other one.
+static descriptor *random_descriptors(int n, int dim, descriptor *src, float noise)
+{
+    descriptor *d = calloc(n, sizeof(descriptor));
+    int i, k;
+    for(i = 0; i < n; ++i){
+        d[i].n = dim;
+        d[i].p.x = i;
+        d[i].data = calloc(dim, sizeof(float));
+        for(k = 0; k < dim; ++k){
+            float r = (float)rand()/RAND_MAX;
+            d[i].data[k] = src ? src[2*i].data[k] + noise*r : r;
+        }
+    }
+    return d;
+}
+
+void test_match_index()
+{
+    int bn = 400, an = 200, dim = 75;
+    int i, ok = 1;
+    descriptor *b = random_descriptors(bn, dim, 0, 0);
+    descriptor *a = random_descriptors(an, dim, b, .01);
+    int *exact = calloc(an, sizeof(int)), *near = calloc(an, sizeof(int));
+    float *edist = calloc(an, sizeof(float)), *ndist = calloc(an, sizeof(float));
+    float *esecond = calloc(an, sizeof(float));
+    exact_nearest(a, an, b, bn, exact, edist, esecond);
+    for(i = 0; i < an; ++i) ok &= exact[i] == 2*i;
+    TEST(ok);
+
+    // The blocked kernel gives up early on candidates, check it against
+    // comparing everything in full.
+    for(i = 0, ok = 1; i < an; ++i){
+        float d1 = INFINITY, d2 = INFINITY;
+        int k, bi = -1;
+        for(k = 0; k < bn; ++k){
+            float d = l1_distance(a[i].data, b[k].data, dim);
+            if(d < d1){ d2 = d1; d1 = d; bi = k; }
+            else if(d < d2) d2 = d;
+        }
+        ok &= bi == exact[i] && within_eps(d1, edist[i]) && within_eps(d2, esecond[i]);
+    }
+    TEST(ok);
+
+    // Enough checks to compare everything makes the forest exact.
+    match_index idx = make_match_index(b, bn, 4);
+    query_match_index(idx, a, an, bn, near, ndist, 0);
+    for(i = 0, ok = 1; i < an; ++i) ok &= near[i] == exact[i] && ndist[i] == edist[i];
+    TEST(ok);
+
+    // A small budget still finds nearly every true neighbour.
+    int found = 0;
+    query_match_index(idx, a, an, 64, near, ndist, 0);
+    for(i = 0; i < an; ++i) found += near[i] == exact[i];
+    TEST(found >= .9*an);
+    free_match_index(idx);
+
+    int en, fn;
+    match_params exact_params = {MATCH_EXACT, 4, 64};
+    match_params forest_params = {MATCH_KDFOREST, 4, bn};
+    match *em = match_descriptors_params(a, an, b, bn, &en, exact_params);
+    match *fm = match_descriptors_params(a, an, b, bn, &fn, forest_params);
+    TEST(en == fn);
+    for(i = 0, ok = 1; i < en && i < fn; ++i) ok &= em[i].ai == fm[i].ai && em[i].bi == fm[i].bi;
+    TEST(ok);
+
+    // Every query is a copy of one descriptor, so none is ambiguous.
+    int rn;
+    match_params ratio_params = {MATCH_EXACT, 4, 64, .8};
+    match *rm = match_descriptors_params(a, an, b, bn, &rn, ratio_params);
+    TEST(rn == en);
+    free(rm);
+    ratio_params.ratio = .01;
+    rm = match_descriptors_params(a, an, b, bn, &rn, ratio_params);
+    TEST(rn < en);
+    free(rm);
+
+    free(em); free(fm);
+    free(exact); free(near); free(edist); free(ndist); free(esecond);
+    free_descriptors(a, an);
+    free_descriptors(b, bn);
+}
+
+void test_descriptor_set()
+{
+    image im = load_image("data/Rainier1.png");
+    int n = 0, i, k;
+    descriptor *d = harris_corner_detector(im, 2, 50, 3, &n);
+    descriptor_set s;
+    TEST(n > 0);
+    TEST(descriptor_set_of(d, n, &s) && s.n == n && s.dim == 5*5*im.c);
+    TEST((size_t)s.vals % 64 == 0 && s.stride % L1_LANES == 0);
+    int same = 1;
+    for(i = 0; i < n; ++i){
+        descriptor e = describe_index(im, s.points[i].x + im.w*s.points[i].y);
+        same &= d[i].p.x == e.p.x && d[i].p.y == e.p.y && d[i].n == e.n;
+        same &= d[i].data == s.vals + (size_t)i*s.stride;
+        for(k = 0; k < e.n; ++k) same &= d[i].data[k] == e.data[k];
+        for(k = e.n; k < s.stride; ++k) same &= d[i].data[k] == 0;
+        free(e.data);
+    }
+    TEST(same);
+    free_descriptors(d, n);
+
+    // No corners still frees like any other result.
+    image flat = make_image(32, 32, 3);
+    d = harris_corner_detector(flat, 2, 50, 3, &n);
+    TEST(n == 0);
+    free_descriptors(d, n);
+    free_image(flat);
+
+    // Sets are known by the marks on their descriptors, not by where their
+    // pointers point. Empty views and plain arrays free alike.
+    s = make_descriptor_set(0, 5*5*im.c, DESCRIPTOR_PATCH);
+    free_descriptors(s.view, 0);
+    s = make_descriptor_set(2, BRIEF_WORDS, DESCRIPTOR_BRIEF);
+    descriptor_set e;
+    TEST(descriptor_set_of(s.view, 2, &e) && e.kind == DESCRIPTOR_BRIEF && e.dim == BRIEF_WORDS);
+    TEST(e.points == s.points && e.vals == s.vals);
+    free_descriptors(s.view, 2);
+    descriptor *plain = calloc(2, sizeof(descriptor));
+    for(i = 0; i < 2; ++i){
+        plain[i].n = 5*5*im.c;
+        plain[i].data = calloc(plain[i].n, sizeof(float));
+    }
+    TEST(!descriptor_set_of(plain, 2, &e) && !descriptor_set_of(plain, 0, &e));
+    free_descriptors(plain, 2);
+
+    // Corners and edges take the clamped path.
+    int xs[] = {0, 1, im.w-1, 7, im.w-2}, ys[] = {0, 9, im.h-1, im.h-2, 1};
+    s = make_descriptor_set(5, 5*5*im.c, DESCRIPTOR_PATCH);
+    for(i = 0; i < 5; ++i){
+        s.points[i].x = xs[i];
+        s.points[i].y = ys[i];
+    }
+    describe_points(im, s);
+    same = 1;
+    for(i = 0; i < 5; ++i){
+        descriptor e = describe_index(im, xs[i] + im.w*ys[i]);
+        for(k = 0; k < e.n; ++k) same &= s.view[i].data[k] == e.data[k];
+        free(e.data);
+    }
+    TEST(same);
+    descriptor_set t;
+    TEST(!descriptor_set_of(s.view + 1, 4, &t));
+    free_descriptor_set(s);
+    free_image(im);
+}
+
+void test_binary_descriptors()
+{
+    image a = load_image("data/Rainier1.png");
+    image b = load_image("data/Rainier2.png");
+    descriptor_set as = harris_descriptor_set(a, 2, 50, 3, DESCRIPTOR_BRIEF);
+    descriptor_set bs = harris_descriptor_set(b, 2, 50, 3, DESCRIPTOR_BRIEF);
+    descriptor_set s;
+    TEST(as.n > 0 && bs.n > 0);
+    TEST(as.dim == BRIEF_WORDS && as.stride*sizeof(float) == BRIEF_BITS/8);
+    TEST(descriptor_set_of(as.view, as.n, &s) && s.kind == DESCRIPTOR_BRIEF);
+
+    // The Hamming search against a bit by bit count over every candidate.
+    int *nearest = calloc(as.n, sizeof(int));
+    float *dist = calloc(as.n, sizeof(float)), *second = calloc(as.n, sizeof(float));
+    hamming_nearest(as.view, as.n, bs.view, bs.n, nearest, dist, second);
+    int same = 1, j, i, k;
+    for(j = 0; j < as.n; ++j){
+        int d1 = BRIEF_BITS + 1, d2 = BRIEF_BITS + 1, best = -1;
+        for(i = 0; i < bs.n; ++i){
+            uint32_t x[BRIEF_WORDS], y[BRIEF_WORDS];
+            memcpy(x, as.view[j].data, sizeof(x));
+            memcpy(y, bs.view[i].data, sizeof(y));
+            int d = 0;
+            for(k = 0; k < BRIEF_BITS; ++k) d += ((x[k/32] ^ y[k/32]) >> (k%32)) & 1;
+            if(d < d1){ d2 = d1; d1 = d; best = i; }
+            else if(d < d2) d2 = d;
+        }
+        same &= nearest[j] == best && dist[j] == d1 && second[j] == d2;
+    }
+    TEST(same);
+
+    // Matching follows the descriptors, and an image matches itself exactly.
+    int mn = 0;
+    match *m = match_descriptors(as.view, as.n, as.view, as.n, &mn);
+    int exact = mn > 0;
+    for(j = 0; j < mn; ++j) exact &= m[j].distance == 0 && m[j].p.x == m[j].q.x && m[j].p.y == m[j].q.y;
+    TEST(exact);
+    free(m);
+
+    // Descriptors of different kinds are never compared.
+    descriptor_set ps = harris_descriptor_set(b, 2, 50, 3, DESCRIPTOR_PATCH);
+    m = match_descriptors(as.view, as.n, ps.view, ps.n, &mn);
+    TEST(mn == 0);
+    free(m);
+    m = match_descriptors(ps.view, ps.n, as.view, as.n, &mn);
+    TEST(mn == 0);
+    free(m);
+    free_descriptor_set(ps);
+
+    set_descriptor_type(DESCRIPTOR_BRIEF);
+    int n = 0;
+    descriptor *d = harris_corner_detector(a, 2, 50, 3, &n);
+    TEST(n == as.n && d[0].n == BRIEF_WORDS && !memcmp(d[0].data, as.vals, BRIEF_BITS/8));
+    set_descriptor_type(DESCRIPTOR_PATCH);
+    free_descriptors(d, n);
+
+    free(nearest); free(dist); free(second);
+    free_descriptor_set(as);
+    free_descriptor_set(bs);
+    free_image(a);
+    free_image(b);
+}
+
+// Non-max suppression by scanning every window with clamped reads.
+static image nms_reference(image im, int w)
+{
+    image r = copy_image(im);
+    int i, j, dx, dy;
+    for(j = 0; j < im.h; ++j){
+        for(i = 0; i < im.w; ++i){
+            float v = get_pixel(im, i, j, 0);
+            for(dy = -w; dy <= w; ++dy){
+                for(dx = -w; dx <= w; ++dx){
+                    if(get_pixel(im, i+dx, j+dy, 0) > v) set_pixel(r, i, j, 0, -999999);
+                }
+            }
+        }
+    }
+    return r;
+}
+
+void test_nms()
+{
+    // Few distinct values, so plateaus and ties are common.
+    image im = make_image(53, 31, 1);
+    int i, k;
+    srand(7);
+    for(i = 0; i < im.w*im.h; ++i) im.data[i] = rand() % 9 - 4;
+    int radii[] = {0, 1, 3, 7, 40};
+    for(k = 0; k < 5; ++k){
+        image r = nms_image(im, radii[k]);
+        image gt = nms_reference(im, radii[k]);
+        TEST(same_image(r, gt));
+        int n = 0, count = 0, same = 1;
+        int *c = nms_corners(im, radii[k], 2, &n);
+        for(i = 0; i < im.w*im.h; ++i){
+            if(gt.data[i] >= 2){
+                same &= count < n && c[count] == i;
+                ++count;
+            }
+        }
+        TEST(same && count == n);
+        free(c);
+        free_image(r);
+        free_image(gt);
+    }
+    free_image(im);
+}
+
+// Structure matrix from full images: gradients, products, then a blur.
+static image structure_reference(image im, float sigma)
+{
+    image gx = make_gx_filter(), gy = make_gy_filter();
+    image ix = convolve_image(im, gx, 0), iy = convolve_image(im, gy, 0);
+    image S = make_image(im.w, im.h, 3);
+    int i, n = im.w*im.h;
+    for(i = 0; i < n; ++i){
+        S.data[i] = ix.data[i]*ix.data[i];
+        S.data[n + i] = iy.data[i]*iy.data[i];
+        S.data[2*n + i] = ix.data[i]*iy.data[i];
+    }
+    image r = gaussian_blur(S, sigma, GAUSSIAN_SEPARABLE);
+    free_image(gx); free_image(gy);
+    free_image(ix); free_image(iy);
+    free_image(S);
+    return r;
+}
+
+void test_harris_response()
+{
+    image ims[3] = {load_image("data/dogbw.png"), load_image("data/Rainier1.png"), make_image(7, 3, 2)};
+    float sigmas[3] = {2, 1, 1.5};
+    int i, k;
+    srand(3);
+    for(i = 0; i < 7*3*2; ++i) ims[2].data[i] = rand() / (float)RAND_MAX;
+    for(k = 0; k < 3; ++k){
+        image S = structure_matrix(ims[k], sigmas[k]);
+        image gt = structure_reference(ims[k], sigmas[k]);
+        TEST(same_image(S, gt));
+        image R = harris_response(ims[k], sigmas[k]);
+        image Rgt = cornerness_response(gt);
+        TEST(same_image(R, Rgt));
+        free_image(S); free_image(gt);
+        free_image(R); free_image(Rgt);
+    }
+    // Wide Gaussians keep the recursive blur of smooth_image.
+    image R = harris_response(ims[0], 6);
+    image S = structure_matrix(ims[0], 6);
+    image Rgt = cornerness_response(S);
+    TEST(same_image(R, Rgt));
+    free_image(R); free_image(S); free_image(Rgt);
+    for(k = 0; k < 3; ++k) free_image(ims[k]);
+}
+
+// Matches under a known homography, the first inl of them exact and the
+// rest random, in order of distance like match_descriptors gives them.
+static match *homography_matches(matrix H, int n, int inl)
+{
+    homography h = make_homography(H);
+    match *m = calloc(n, sizeof(match));
+    int i;
+    for(i = 0; i < n; ++i){
+        point r = {rand() % 500, rand() % 400};
+        m[i].p.x = rand() % 500;
+        m[i].p.y = rand() % 400;
+        m[i].q = i < inl ? homography_project(h, m[i].p) : r;
+        m[i].ai = m[i].bi = i;
+        m[i].distance = i;
+    }
+    return m;
+}
+
+void test_ransac()
+{
+    TEST(ransac_iterations(.5, .99, 10000) == 72);
+    TEST(ransac_iterations(0, .99, 100) == 100);
+    TEST(ransac_iterations(.5, 0, 100) == 100);
+    TEST(ransac_iterations(1, .99, 100) == 1);
+
+    matrix H = make_translation_homography(30, -12);
+    H.data[0][1] = .05;
+    H.data[2][0] = .0002;
+    int n = 200, inl = 140, used = 0, i;
+    srand(5);
+    match *m = homography_matches(H, n, inl);
+    ransac_params adaptive = {.99, 1, 1}, uniform = {.99, 0, 1}, fixed = {0, 0, 1};
+    // RANSAC samples uniformly unless asked, since its matches need not be
+    // sorted.
+    TEST(!get_ransac_params().prosac);
+
+    // PROSAC finds the model in the first few samples of the best matches.
+    matrix R = RANSAC_params(m, n, 2, 10000, n, adaptive, &used);
+    TEST(used > 0 && used < 50);
+    int front = 1;
+    for(i = 0; i < inl; ++i) front &= m[i].ai < inl;
+    TEST(front && model_inliers(R, m, n, 2) == inl);
+    free_matrix(R);
+
+    // Uniform samples stop once an all inlier sample is likely.
+    R = RANSAC_params(m, n, 2, 10000, n, uniform, &used);
+    TEST(used <= ransac_iterations((float)inl/n, .99, 10000) && model_inliers(R, m, n, 2) == inl);
+    free_matrix(R);
+
+    R = RANSAC_params(m, n, 2, 300, n, fixed, &used);
+    TEST(used == 300 && model_inliers(R, m, n, 2) == inl);
+    free_matrix(R);
+
+    // The inlier cutoff still ends the search at once.
+    R = RANSAC_params(m, n, 2, 10000, inl/2, fixed, &used);
+    TEST(used < 300 && model_inliers(R, m, n, 2) == inl);
+    free_matrix(R);
+
+    free(m);
+    free_matrix(H);
+}
+
+void test_homography_inliers()
+{
+    matrix H = make_translation_homography(12, 7);
+    H.data[0][0] = 1.1;
+    H.data[2][1] = -.0003;
+    int n = 203, inl = 90, i;
+    srand(3);
+    match *m = homography_matches(H, n, inl);
+    // Some matches just inside and just outside the threshold.
+    for(i = inl; i < inl + 20; ++i){
+        m[i].q = homography_project(make_homography(H), m[i].p);
+        m[i].q.x += i % 2 ? 1.9 : 2.1;
+    }
+    match_coords c = make_match_coords(m, n);
+    unsigned char *mask = calloc(n / 8 + 1, 1);
+    int count = homography_inliers(make_homography(H), c, 2, mask);
+    int agree = 1, expect = 0;
+    for(i = 0; i < n; ++i){
+        point p = homography_project(make_homography(H), m[i].p);
+        float dx = p.x - m[i].q.x, dy = p.y - m[i].q.y;
+        int in = sqrtf(dx*dx + dy*dy) < 2;
+        expect += in;
+        agree &= in == (mask[i / 8] >> (i % 8) & 1);
+    }
+    TEST(agree && count == expect && count == inl + 10);
+    TEST(homography_inliers(make_homography(H), c, 2, 0) == count);
+
+    // Inliers move to the front, and both sides keep their order.
+    TEST(order_inliers(m, n, mask) == count);
+    int ordered = 1;
+    for(i = 1; i < n; ++i){
+        if(i != count) ordered &= m[i - 1].ai < m[i].ai;
+    }
+    TEST(ordered && model_inliers(H, m, n, 2) == count);
+
+    free(mask);
+    free_match_coords(c);
+    free(m);
+    free_matrix(H);
+}
+
+static int same_matrix(matrix a, matrix b)
+{
+    int i, j;
+    if(a.rows != b.rows || a.cols != b.cols) return 0;
+    for(i = 0; i < a.rows; ++i){
+        for(j = 0; j < a.cols; ++j){
+            if(a.data[i][j] != b.data[i][j]) return 0;
+        }
+    }
+    return 1;
+}
+
+void test_parallel_ransac()
+{
+    matrix H = make_translation_homography(-40, 25);
+    H.data[1][0] = -.03;
+    H.data[2][1] = .0001;
+    int n = 400, inl = 60, used = 0, again = 0, i, j;
+    srand(7);
+    match *m = homography_matches(H, n, inl);
+    // Inliers spread out, so PROSAC has no head start.
+    for(i = n - 1; i > 0; --i){
+        j = rand() % (i + 1);
+        match t = m[i]; m[i] = m[j]; m[j] = t;
+    }
+    match *copy = calloc(n, sizeof(match));
+    memcpy(copy, m, n*sizeof(match));
+    ransac_params p = {.99, 0, 3, 1234};
+
+    // Three threads find every inlier, and the same seed gives the same
+    // model and the same number of samples.
+    matrix R = RANSAC_params(m, n, 2, 20000, n, p, &used);
+    TEST(model_inliers(R, m, n, 2) == inl);
+    memcpy(m, copy, n*sizeof(match));
+    matrix S = RANSAC_params(m, n, 2, 20000, n, p, &again);
+    TEST(used == again && same_matrix(R, S));
+    free_matrix(R);
+    free_matrix(S);
+
+    // As does a single thread, drawing one sample at a time.
+    p.threads = 1;
+    memcpy(m, copy, n*sizeof(match));
+    R = RANSAC_params(m, n, 2, 20000, n, p, &used);
+    memcpy(m, copy, n*sizeof(match));
+    S = RANSAC_params(m, n, 2, 20000, n, p, &again);
+    TEST(used == again && same_matrix(R, S) && model_inliers(R, m, n, 2) == inl);
+    free_matrix(R);
+    free_matrix(S);
+
+    free(copy);
+    free(m);
+    free_matrix(H);
+}
+
+void test_homography_solvers()
+{
+    matrix H = make_translation_homography(30, -12);
+    H.data[0][1] = .05;
+    H.data[2][0] = .0002;
+    homography h = make_homography(H), r;
+    int i, same;
+    srand(9);
+    match *m = homography_matches(H, 50, 50);
+
+    TEST(solve_homography_4(m, &r));
+    for(i = 0, same = 1; i < 9; ++i) same &= fabs(r.h[i/3][i%3] - h.h[i/3][i%3]) < 1e-6*(1 + fabs(h.h[i/3][i%3]));
+    TEST(same);
+    TEST(refit_homography(m, 50, &r));
+    for(i = 0, same = 1; i < 9; ++i) same &= fabs(r.h[i/3][i%3] - h.h[i/3][i%3]) < 1e-6*(1 + fabs(h.h[i/3][i%3]));
+    TEST(same);
+
+    // Noisy matches: every point lands close to where it should.
+    for(i = 0; i < 50; ++i){
+        m[i].q.x += (rand() % 101 - 50) / 100.;
+        m[i].q.y += (rand() % 101 - 50) / 100.;
+    }
+    matrix R = compute_homography(m, 50);
+    homography rh = make_homography(R);
+    for(i = 0, same = 1; i < 50; ++i){
+        point a = homography_project(rh, m[i].p), b = homography_project(h, m[i].p);
+        same &= fabs(a.x - b.x) < .5 && fabs(a.y - b.y) < .5;
+    }
+    TEST(same);
+    free_matrix(R);
+
+    // Three points on a line leave the homography undetermined.
+    match line[4];
+    memcpy(line, m, sizeof(line));
+    line[2].p.x = (line[0].p.x + line[1].p.x) / 2;
+    line[2].p.y = (line[0].p.y + line[1].p.y) / 2;
+    line[2].q = homography_project(h, line[2].p);
+    TEST(!solve_homography_4(line, &r));
+    R = compute_homography(line, 4);
+    TEST(!R.data);
+    TEST(!refit_homography(m, 3, &r));
+
+    free(m);
+    free_matrix(H);
+}
+
 void run_tests()
 {
     //test_matrix();
@@ -383,6 +985,7 @@ void run_tests()
     test_nn_resize();
     test_bl_resize();
     test_multiple_resize();
+    test_padded_image();
     test_gaussian_filter();
     test_sharpen_filter();
     test_emboss_filter();
@@ -392,8 +995,19 @@ void run_tests()
     test_hybrid_image();
     test_frequency_image();
     test_sobel();
+    test_smooth_image();
     test_structure();
     test_cornerness();
+    test_harris_response();
+    test_nms();
+    test_combine_images();
+    test_homography_solvers();
+    test_homography_inliers();
+    test_ransac();
+    test_parallel_ransac();
+    test_match_index();
+    test_descriptor_set();
+    test_binary_descriptors();
     printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
 }
 
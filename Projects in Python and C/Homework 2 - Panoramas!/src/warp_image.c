@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "image.h"
+#include "matrix.h"
+#include "warp_image.h"
+
+// Copy a 3x3 matrix into a fixed size homography.
+// matrix H: 3x3 homography.
+// returns: the same transformation with no heap storage.
+homography make_homography(matrix H)
+{
+    assert(H.rows == 3 && H.cols == 3);
+    homography r;
+    int i, j;
+    for(i = 0; i < 3; ++i){
+        for(j = 0; j < 3; ++j){
+            r.h[i][j] = H.data[i][j];
+        }
+    }
+    return r;
+}
+
+// Copy a fixed size homography into a 3x3 matrix.
+// homography H: transformation.
+// returns: new 3x3 matrix, free with free_matrix.
+matrix homography_matrix(homography H)
+{
+    matrix r = make_matrix(3, 3);
+    int i, j;
+    for(i = 0; i < 3; ++i){
+        for(j = 0; j < 3; ++j){
+            r.data[i][j] = H.h[i][j];
+        }
+    }
+    return r;
+}
+
+// Apply a homography to a point.
+// homography H: transformation.
+// point p: point to project.
+// returns: projected point.
+point homography_project(homography H, point p)
+{
+    double x = H.h[0][0]*p.x + H.h[0][1]*p.y + H.h[0][2];
+    double y = H.h[1][0]*p.x + H.h[1][1]*p.y + H.h[1][2];
+    double z = H.h[2][0]*p.x + H.h[2][1]*p.y + H.h[2][2];
+    point r;
+    r.x = x / z;
+    r.y = y / z;
+    return r;
+}
+
+// Copy an image into a larger canvas at an offset, row at a time.
+// image dst: canvas to write into.
+// image src: image to paste.
+// int dx, dy: canvas position of src pixel (0,0) is (-dx, -dy).
+void paste_image(image dst, image src, int dx, int dy)
+{
+    int x0 = MAX(0, -dx);
+    int x1 = MIN(dst.w, src.w - dx);
+    int y0 = MAX(0, -dy);
+    int y1 = MIN(dst.h, src.h - dy);
+    if(x1 <= x0) return;
+    int k, j;
+    for(k = 0; k < dst.c && k < src.c; ++k){
+        for(j = y0; j < y1; ++j){
+            memcpy(dst.data + k*dst.w*dst.h + j*dst.w + x0,
+                   src.data + k*src.w*src.h + (j + dy)*src.w + x0 + dx,
+                   (x1 - x0)*sizeof(float));
+        }
+    }
+}
+
+// Inverse warp src into dst with bilinear sampling of every channel at once.
+// Along each row the projective numerators and denominator are linear in x,
+// so they are stepped by one column of H instead of re-projecting.
+// image dst: canvas to write into.
+// image src: image to sample from.
+// homography H: maps canvas coordinates (plus offset) into src coordinates.
+// int dx, dy: canvas pixel (x, y) corresponds to coordinates (x + dx, y + dy).
+// point topleft, botright: region of those coordinates to fill.
+void warp_image_into(image dst, image src, homography H, int dx, int dy, point topleft, point botright)
+{
+    int xs = MAX((int)topleft.x, dx);
+    int ys = MAX((int)topleft.y, dy);
+    int xe = MIN((int)ceilf(botright.x), dst.w + dx);
+    int ye = MIN((int)ceilf(botright.y), dst.h + dy);
+    int sw = src.w, sh = src.h;
+    int splane = src.w*src.h, dplane = dst.w*dst.h;
+    int j;
+    #pragma omp parallel for schedule(static)
+    for(j = ys; j < ye; ++j){
+        double nx = H.h[0][0]*xs + H.h[0][1]*j + H.h[0][2];
+        double ny = H.h[1][0]*xs + H.h[1][1]*j + H.h[1][2];
+        double nz = H.h[2][0]*xs + H.h[2][1]*j + H.h[2][2];
+        float *drow = dst.data + (j - dy)*dst.w - dx;
+        int i, k;
+        for(i = xs; i < xe && i < botright.x; ++i){
+            float x = nx / nz;
+            float y = ny / nz;
+            nx += H.h[0][0];
+            ny += H.h[1][0];
+            nz += H.h[2][0];
+            if(!(x >= 0 && x < sw && y >= 0 && y < sh)) continue;
+            int x0 = (int)x, y0 = (int)y;
+            int x1 = x0 + 1 < sw ? x0 + 1 : sw - 1;
+            int y1 = y0 + 1 < sh ? y0 + 1 : sh - 1;
+            float fx = x - x0, fy = y - y0;
+            float w00 = (1 - fx)*(1 - fy), w10 = fx*(1 - fy);
+            float w01 = (1 - fx)*fy,       w11 = fx*fy;
+            const float *r0 = src.data + y0*sw;
+            const float *r1 = src.data + y1*sw;
+            for(k = 0; k < dst.c; ++k){
+                int off = (k < src.c ? k : src.c - 1)*splane;
+                drow[k*dplane + i] = w00*r0[off + x0] + w10*r0[off + x1]
+                                   + w01*r1[off + x0] + w11*r1[off + x1];
+            }
+        }
+    }
+}
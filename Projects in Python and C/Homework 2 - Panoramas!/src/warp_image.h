@@ -0,0 +1,18 @@
+#ifndef WARP_IMAGE_H
+#define WARP_IMAGE_H
+#include "image.h"
+#include "matrix.h"
+
+// A fixed size 3x3 projective transformation.
+// double h[3][3]: row-major homography entries.
+typedef struct{
+    double h[3][3];
+} homography;
+
+homography make_homography(matrix H);
+matrix homography_matrix(homography H);
+point homography_project(homography H, point p);
+void paste_image(image dst, image src, int dx, int dy);
+void warp_image_into(image dst, image src, homography H, int dx, int dy, point topleft, point botright);
+
+#endif
@@ -27,6 +27,8 @@ class POINT(Structure):
 class DESCRIPTOR(Structure):
     _fields_ = [("p", POINT),
                 ("n", c_int),
+                ("kind", c_ubyte),
+                ("shared", c_ubyte),
                 ("data", POINTER(c_float))]
 
 add_image = lib.add_image
@@ -177,11 +179,17 @@ find_and_draw_matches = lib.find_and_draw_matches
 find_and_draw_matches.argtypes = [IMAGE, IMAGE, c_float, c_float, c_int]
 find_and_draw_matches.restype = IMAGE
 
+PATCH, BRIEF = 0, 1
+set_descriptor_type = lib.set_descriptor_type
+set_descriptor_type.argtypes = [c_int]
+set_descriptor_type.restype = None
+
 panorama_image_lib = lib.panorama_image
 panorama_image_lib.argtypes = [IMAGE, IMAGE, c_float, c_float, c_int, c_float, c_int, c_int]
 panorama_image_lib.restype = IMAGE
 
-def panorama_image(a, b, sigma=2, thresh=5, nms=3, inlier_thresh=2, iters=10000, cutoff=30):
+def panorama_image(a, b, sigma=2, thresh=5, nms=3, inlier_thresh=2, iters=10000, cutoff=30, descriptor=PATCH):
+    set_descriptor_type(descriptor)
     return panorama_image_lib(a, b, sigma, thresh, nms, inlier_thresh, iters, cutoff)
 
 if __name__ == "__main__":
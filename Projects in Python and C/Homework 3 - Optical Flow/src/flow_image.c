@@ -5,6 +5,9 @@
 #include <assert.h>
 #include "image.h"
 #include "matrix.h"
+#include "integral_image.h"
+#include "time_structure.h"
+#include "pyramid_flow.h"
 
 // Draws a line on an image with color corresponding to the direction of line
 // image im: image to draw line on
@@ -48,6 +51,16 @@ image make_integral_image(image im)
 {
     image integ = make_image(im.w, im.h, im.c);
     // TODO: fill in the integral image
+    summed_table t = make_summed_table(im, get_integral_precision());
+    int k, j, i;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < im.h; ++j){
+            float *out = integ.data + (size_t)k*im.w*im.h + (size_t)j*im.w;
+            size_t row = (size_t)k*t.plane + (size_t)(j + 1)*t.stride + 1;
+            for(i = 0; i < im.w; ++i) out[i] = t.d ? t.d[row + i] : t.f[row + i];
+        }
+    }
+    free_summed_table(t);
     return integ;
 }
 
@@ -57,10 +70,11 @@ image make_integral_image(image im)
 // returns: smoothed image
 image box_filter_image(image im, int s)
 {
-    int i,j,k;
-    image integ = make_integral_image(im);
-    image S = make_image(im.w, im.h, im.c);
     // TODO: fill in S using the integral image.
+    // Every channel is summed in one table and filtered in one pass.
+    summed_table t = make_summed_table(im, get_integral_precision());
+    image S = box_filter_table(t, s);
+    free_summed_table(t);
     return S;
 }
 
@@ -72,23 +86,8 @@ image box_filter_image(image im, int s)
 //          3rd channel is IxIy, 4th channel is IxIt, 5th channel is IyIt.
 image time_structure_matrix(image im, image prev, int s)
 {
-    int i;
-    int converted = 0;
-    if(im.c == 3){
-        converted = 1;
-        im = rgb_to_grayscale(im);
-        prev = rgb_to_grayscale(prev);
-    }
-
     // TODO: calculate gradients, structure components, and smooth them
-
-
-
-
-    if(converted){
-        free_image(im); free_image(prev);
-    }
-    return S;
+    return time_structure_samples(im, prev, s, 1);
 }
 
 // Calculate the velocity given a structure image
@@ -97,25 +96,14 @@ image time_structure_matrix(image im, image prev, int s)
 image velocity_image(image S, int stride)
 {
     image v = make_image(S.w/stride, S.h/stride, 3);
-    int i, j;
-    matrix M = make_matrix(2,2);
-    for(j = (stride-1)/2; j < S.h; j += stride){
-        for(i = (stride-1)/2; i < S.w; i += stride){
-            float Ixx = S.data[i + S.w*j + 0*S.w*S.h];
-            float Iyy = S.data[i + S.w*j + 1*S.w*S.h];
-            float Ixy = S.data[i + S.w*j + 2*S.w*S.h];
-            float Ixt = S.data[i + S.w*j + 3*S.w*S.h];
-            float Iyt = S.data[i + S.w*j + 4*S.w*S.h];
-
-            // TODO: calculate vx and vy using the flow equation
-            float vx = 0;
-            float vy = 0;
-
-            set_pixel(v, i/stride, j/stride, 0, vx);
-            set_pixel(v, i/stride, j/stride, 1, vy);
-        }
+    int j, off = (stride-1)/2;
+    // TODO: calculate vx and vy using the flow equation
+    // Solved in closed form a row of samples at a time.
+    #pragma omp parallel for
+    for(j = 0; j < v.h; ++j){
+        const float *s = S.data + (size_t)S.w*(off + j*stride) + off;
+        solve_velocity(s, (size_t)S.w*S.h, v.w, stride, v.data + j*v.w, v.data + v.w*v.h + j*v.w);
     }
-    free_matrix(M);
     return v;
 }
 
@@ -151,6 +139,16 @@ void constrain_image(image im, float v)
     }
 }
 
+// Limit and smooth a raw flow grid. Pyramids follow larger motions, so
+// the limit doubles with every level.
+static image finish_flow(image v, int levels)
+{
+    constrain_image(v, 6 << (levels - 1));
+    image vs = smooth_image(v, 2);
+    free_image(v);
+    return vs;
+}
+
 // Calculate the optical flow between two images
 // image im: current image
 // image prev: previous image
@@ -159,13 +157,33 @@ void constrain_image(image im, float v)
 // returns: velocity matrix
 image optical_flow_images(image im, image prev, int smooth, int stride)
 {
-    image S = time_structure_matrix(im, prev, smooth);   
-    image v = velocity_image(S, stride);
-    constrain_image(v, 6);
-    image vs = smooth_image(v, 2);
-    free_image(v);
+    flow_params p = get_flow_params();
+    if(p.levels > 1 || p.iters > 1){
+        image_pyramid a = make_image_pyramid(im, p.levels);
+        image_pyramid b = make_image_pyramid(prev, p.levels);
+        image v = optical_flow_pyramids(a, b, smooth, stride);
+        free_image_pyramid(a);
+        free_image_pyramid(b);
+        return v;
+    }
+    // Only the centres velocity_image reads are computed.
+    image S = time_structure_samples(im, prev, smooth, stride);
+    image v = velocity_image(S, 1);
     free_image(S);
-    return vs;
+    return finish_flow(v, 1);
+}
+
+// Calculate the optical flow between two frames from their pyramids, with
+// the refinement steps set by set_flow_params.
+// image_pyramid im: pyramid of the current image
+// image_pyramid prev: pyramid of the previous image
+// int smooth: amount to smooth structure matrix by
+// int stride: downsampling for velocity matrix
+// returns: velocity matrix
+image optical_flow_pyramids(image_pyramid im, image_pyramid prev, int smooth, int stride)
+{
+    image v = pyramid_flow(im, prev, smooth, stride, MAX(1, get_flow_params().iters));
+    return finish_flow(v, im.levels);
 }
 
 // Run optical flow demo on webcam
@@ -181,17 +199,31 @@ void optical_flow_webcam(int smooth, int stride, int div)
     image prev_c = nn_resize(prev, prev.w/div, prev.h/div);
     image im = get_image_from_stream(cap);
     image im_c = nn_resize(im, im.w/div, im.h/div);
+    // With pyramids, each frame's is built once and kept as the next one's
+    // prev. Single scale flow needs none, like optical_flow_images.
+    flow_params p = get_flow_params();
+    int pyramids = p.levels > 1 || p.iters > 1;
+    image_pyramid prev_p = {0}, im_p = {0};
+    if(pyramids) prev_p = make_image_pyramid(prev_c, p.levels);
     while(im.data){
         image copy = copy_image(im);
-        image v = optical_flow_images(im_c, prev_c, smooth, stride);
+        image v;
+        if(pyramids){
+            im_p = make_image_pyramid(im_c, p.levels);
+            v = optical_flow_pyramids(im_p, prev_p, smooth, stride);
+        } else {
+            v = optical_flow_images(im_c, prev_c, smooth, stride);
+        }
         draw_flow(copy, v, smooth*div);
         int key = show_image(copy, "flow", 5);
         free_image(v);
         free_image(copy);
         free_image(prev);
         free_image(prev_c);
+        free_image_pyramid(prev_p);
         prev = im;
         prev_c = im_c;
+        prev_p = im_p;
         if(key != -1) {
             key = key % 256;
             printf("%d\n", key);
@@ -200,6 +232,7 @@ void optical_flow_webcam(int smooth, int stride, int div)
         im = get_image_from_stream(cap);
         im_c = nn_resize(im, im.w/div, im.h/div);
     }
+    free_image_pyramid(prev_p);
 #else
     fprintf(stderr, "Must compile with OpenCV\n");
 #endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include "image.h"
+#include "integral_image.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Table rows are padded to a multiple of this many entries.
+#define INTEGRAL_LANES 8
+// Columns each thread accumulates down the table at once.
+#define INTEGRAL_STRIP 256
+
+// Precision make_integral_image and box_filter_image build tables with.
+static INTEGRAL_PRECISION integral_precision = INTEGRAL_FLOAT;
+
+// Choose the precision of the tables behind make_integral_image and
+// box_filter_image, for every later call.
+void set_integral_precision(INTEGRAL_PRECISION p)
+{
+    integral_precision = p;
+}
+
+INTEGRAL_PRECISION get_integral_precision()
+{
+    return integral_precision;
+}
+
+// Inclusive prefix sum of a row, scanned four floats at a time in a
+// register and carried from one group of four to the next.
+static void prefix_row_f(const float *src, float *dst, int n)
+{
+    int i = 0;
+    float sum = 0;
+#if defined(__SSE2__)
+    __m128 carry = _mm_setzero_ps();
+    for(; i + 4 <= n; i += 4){
+        __m128 v = _mm_loadu_ps(src + i);
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, carry);
+        _mm_storeu_ps(dst + i, v);
+        carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    sum = _mm_cvtss_f32(carry);
+#endif
+    for(; i < n; ++i) dst[i] = sum += src[i];
+}
+
+// Inclusive prefix sum of a row of floats into doubles, two at a time.
+static void prefix_row_d(const float *src, double *dst, int n)
+{
+    int i = 0;
+    double sum = 0;
+#if defined(__SSE2__)
+    __m128d carry = _mm_setzero_pd();
+    for(; i + 2 <= n; i += 2){
+        __m128d v = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(src + i))));
+        v = _mm_add_pd(v, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(v), 8)));
+        v = _mm_add_pd(v, carry);
+        _mm_storeu_pd(dst + i, v);
+        carry = _mm_unpackhi_pd(v, v);
+    }
+    sum = _mm_cvtsd_f64(carry);
+#endif
+    for(; i < n; ++i) dst[i] = sum += src[i];
+}
+
+// Build the summed area table of every channel of an image: a prefix sum
+// along each row, then a running sum down each column. Rows are split
+// between threads in the first pass, channels and column strips in the
+// second.
+// image im: image to sum.
+// INTEGRAL_PRECISION p: what the table stores.
+// returns: the table, free with free_summed_table.
+summed_table make_summed_table(image im, INTEGRAL_PRECISION p)
+{
+    summed_table t;
+    t.w = im.w;
+    t.h = im.h;
+    t.c = im.c;
+    t.stride = (im.w + 1 + INTEGRAL_LANES - 1) / INTEGRAL_LANES * INTEGRAL_LANES;
+    t.plane = (im.h + 1)*t.stride;
+    t.precision = p;
+    size_t count = (size_t)im.c*t.plane;
+    t.f = p == INTEGRAL_FLOAT ? calloc(count ? count : 1, sizeof(float)) : 0;
+    t.d = p == INTEGRAL_DOUBLE ? calloc(count ? count : 1, sizeof(double)) : 0;
+
+    int r, b, strips = (im.w + 1 + INTEGRAL_STRIP - 1) / INTEGRAL_STRIP;
+    #pragma omp parallel for
+    for(r = 0; r < im.c*im.h; ++r){
+        int k = r / im.h, j = r % im.h;
+        size_t row = (size_t)k*t.plane + (size_t)(j + 1)*t.stride + 1;
+        const float *src = im.data + (size_t)r*im.w;
+        if(t.d) prefix_row_d(src, t.d + row, im.w);
+        else prefix_row_f(src, t.f + row, im.w);
+    }
+    #pragma omp parallel for
+    for(b = 0; b < im.c*strips; ++b){
+        int k = b / strips;
+        int x0 = (b % strips)*INTEGRAL_STRIP, x1 = MIN(x0 + INTEGRAL_STRIP, im.w + 1);
+        int j, x;
+        if(t.d){
+            for(j = 1; j <= im.h; ++j){
+                double *row = t.d + (size_t)k*t.plane + (size_t)j*t.stride;
+                for(x = x0; x < x1; ++x) row[x] += row[x - t.stride];
+            }
+        } else {
+            double acc[INTEGRAL_STRIP] = {0};
+            for(j = 1; j <= im.h; ++j){
+                float *row = t.f + (size_t)k*t.plane + (size_t)j*t.stride;
+                for(x = x0; x < x1; ++x) row[x] = acc[x - x0] += row[x];
+            }
+        }
+    }
+    return t;
+}
+
+void free_summed_table(summed_table t)
+{
+    free(t.f);
+    free(t.d);
+}
+
+// One output row of a box filter, from the table rows at the top and
+// bottom of its windows. Windows span columns x - lo to x + hi - 1 and
+// are averaged over the pixels they cover, so near the left and right
+// edges they are clipped and divided by a smaller area.
+static void box_row_f(const float *top, const float *bot, float *out, int w, int lo, int hi, int rows)
+{
+    int x, in0 = MIN(lo, w), in1 = MAX(in0, w - hi + 1);
+    float inv = 1.f / (rows*(lo + hi));
+    for(x = 0; x < in0; ++x){
+        int x1 = MIN(w, x + hi);
+        out[x] = ((bot[x1] - top[x1]) - (bot[0] - top[0])) / (rows*x1);
+    }
+    for(; x < in1; ++x){
+        out[x] = ((bot[x + hi] - top[x + hi]) - (bot[x - lo] - top[x - lo]))*inv;
+    }
+    for(; x < w; ++x){
+        int x0 = MAX(0, x - lo);
+        out[x] = ((bot[w] - top[w]) - (bot[x0] - top[x0])) / (rows*(w - x0));
+    }
+}
+
+static void box_row_d(const double *top, const double *bot, float *out, int w, int lo, int hi, int rows)
+{
+    int x, in0 = MIN(lo, w), in1 = MAX(in0, w - hi + 1);
+    double inv = 1.0 / (rows*(lo + hi));
+    for(x = 0; x < in0; ++x){
+        int x1 = MIN(w, x + hi);
+        out[x] = ((bot[x1] - top[x1]) - (bot[0] - top[0])) / (rows*x1);
+    }
+    for(; x < in1; ++x){
+        out[x] = ((bot[x + hi] - top[x + hi]) - (bot[x - lo] - top[x - lo]))*inv;
+    }
+    for(; x < w; ++x){
+        int x0 = MAX(0, x - lo);
+        out[x] = ((bot[w] - top[w]) - (bot[x0] - top[x0])) / (rows*(w - x0));
+    }
+}
+
+// Average every channel over an s x s window around each pixel, in time
+// independent of s. Windows are clipped at the borders and averaged over
+// the pixels left in them.
+// summed_table t: table of the image to filter.
+// int s: window size.
+// returns: the filtered image.
+image box_filter_table(summed_table t, int s)
+{
+    image S = make_image(t.w, t.h, t.c);
+    int lo = s / 2, hi = s - lo, r;
+    #pragma omp parallel for
+    for(r = 0; r < t.c*t.h; ++r){
+        int k = r / t.h, j = r % t.h;
+        int y0 = MAX(0, j - lo), y1 = MIN(t.h, j + hi);
+        size_t top = (size_t)k*t.plane + (size_t)y0*t.stride;
+        size_t bot = (size_t)k*t.plane + (size_t)y1*t.stride;
+        float *out = S.data + (size_t)r*t.w;
+        if(t.d) box_row_d(t.d + top, t.d + bot, out, t.w, lo, hi, y1 - y0);
+        else box_row_f(t.f + top, t.f + bot, out, t.w, lo, hi, y1 - y0);
+    }
+    return S;
+}
@@ -0,0 +1,52 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+#include <stddef.h>
+#include "image.h"
+
+// What a summed area table stores.
+// INTEGRAL_FLOAT:  floats, accumulated in double down the columns so only
+//                  the final rounding is lost.
+// INTEGRAL_DOUBLE: doubles, for large frames whose window sums would be
+//                  the small difference of large float totals.
+typedef enum{INTEGRAL_FLOAT, INTEGRAL_DOUBLE} INTEGRAL_PRECISION;
+
+// Summed area table of every channel of an image, with a zero row and
+// column in front so any window sum is four reads and no bounds checks.
+// Entry (x, y) of channel c is the sum of pixels i < x, j < y.
+// int w, h, c: size of the image summed.
+// int stride: entries between the starts of two rows, w + 1 rounded up.
+// int plane: entries between the starts of two channels.
+// INTEGRAL_PRECISION precision: which of f and d holds the table.
+// float *f: the table, if INTEGRAL_FLOAT.
+// double *d: the table, if INTEGRAL_DOUBLE.
+typedef struct{
+    int w, h, c;
+    int stride, plane;
+    INTEGRAL_PRECISION precision;
+    float *f;
+    double *d;
+} summed_table;
+
+void set_integral_precision(INTEGRAL_PRECISION p);
+INTEGRAL_PRECISION get_integral_precision();
+
+summed_table make_summed_table(image im, INTEGRAL_PRECISION p);
+void free_summed_table(summed_table t);
+image box_filter_table(summed_table t, int s);
+
+image make_integral_image(image im);
+image box_filter_image(image im, int s);
+
+// Sum of channel c over the pixels x0 <= x < x1, y0 <= y < y1.
+// Bounds must be within 0..w and 0..h.
+static inline double window_sum(summed_table t, int c, int x0, int y0, int x1, int y1)
+{
+    size_t a = (size_t)c*t.plane + (size_t)y0*t.stride;
+    size_t b = (size_t)c*t.plane + (size_t)y1*t.stride;
+    if(t.precision == INTEGRAL_DOUBLE){
+        return (t.d[b + x1] - t.d[a + x1]) - (t.d[b + x0] - t.d[a + x0]);
+    }
+    return ((double)t.f[b + x1] - t.f[a + x1]) - ((double)t.f[b + x0] - t.f[a + x0]);
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "pyramid_flow.h"
+#include "klt_tracker.h"
+
+// Corners are detected with this many pixels of the frame around the
+// cells scanned, beyond the Harris smoothing, so responses at the edges
+// of the cells are the ones the whole frame would give.
+#define KLT_MARGIN 2
+
+// Settings make_klt_tracker uses.
+static klt_params klt = {2, 50, 3, 9, 3, 10, 1, 32, 5};
+
+// Choose the settings of trackers made from now on.
+void set_klt_params(klt_params p)
+{
+    klt = p;
+}
+
+klt_params get_klt_params()
+{
+    return klt;
+}
+
+// Append a track, growing the arrays as needed.
+static void add_track(klt_tracker *t, float x, float y)
+{
+    if(t->n == t->size){
+        t->size = t->size ? 2*t->size : 64;
+        t->p = realloc(t->p, t->size*sizeof(point));
+        t->id = realloc(t->id, t->size*sizeof(int));
+        t->age = realloc(t->age, t->size*sizeof(int));
+    }
+    t->p[t->n].x = x;
+    t->p[t->n].y = y;
+    t->id[t->n] = t->next_id++;
+    t->age[t->n] = 0;
+    ++t->n;
+}
+
+// Whether a point is within nms pixels of a track.
+static int near_track(klt_tracker *t, float x, float y)
+{
+    float r = t->params.nms;
+    int i;
+    for(i = 0; i < t->n; ++i){
+        float dx = t->p[i].x - x, dy = t->p[i].y - y;
+        if(dx*dx + dy*dy < r*r) return 1;
+    }
+    return 0;
+}
+
+// Cell a point of the frame falls in.
+static int cell_of(klt_tracker *t, point p)
+{
+    int i = MIN(MAX((int)p.x / t->params.cell, 0), t->cw - 1);
+    int j = MIN(MAX((int)p.y / t->params.cell, 0), t->ch - 1);
+    return i + j*t->cw;
+}
+
+// Run the Harris detector on cells c0 <= c < c1 of cell row r, a crop of
+// the frame around them, and start a track at every corner inside them
+// that is not next to one already followed.
+static void detect_span(klt_tracker *t, image im, int r, int c0, int c1)
+{
+    klt_params p = t->params;
+    int m = 3*p.sigma + p.nms + KLT_MARGIN;
+    int x0 = c0*p.cell, x1 = MIN(im.w, c1*p.cell);
+    int y0 = r*p.cell, y1 = MIN(im.h, (r + 1)*p.cell);
+    int cx0 = MAX(0, x0 - m), cy0 = MAX(0, y0 - m);
+    int cx1 = MIN(im.w, x1 + m), cy1 = MIN(im.h, y1 + m);
+    image crop = make_image(cx1 - cx0, cy1 - cy0, im.c);
+    int k, j, n = 0;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < crop.h; ++j){
+            memcpy(crop.data + (size_t)k*crop.w*crop.h + (size_t)j*crop.w,
+                    im.data + (size_t)k*im.w*im.h + (size_t)(cy0 + j)*im.w + cx0, crop.w*sizeof(float));
+        }
+    }
+    descriptor *d = harris_corner_detector(crop, p.sigma, p.thresh, p.nms, &n);
+    for(k = 0; k < n; ++k){
+        float x = d[k].p.x + cx0, y = d[k].p.y + cy0;
+        if(x < x0 || x >= x1 || y < y0 || y >= y1) continue;
+        if(near_track(t, x, y)) continue;
+        add_track(t, x, y);
+    }
+    free_descriptors(d, n);
+    free_image(crop);
+}
+
+// Look for new corners in every run of cells along each row that are
+// wanted: every cell when all is set, otherwise the cells that have held a
+// track and lost it. Work follows the area of those cells, not the frame.
+static void detect_tracks(klt_tracker *t, image im, int all)
+{
+    int cells = t->cw*t->ch, i, r, c;
+    int *count = calloc(cells, sizeof(int));
+    for(i = 0; i < t->n; ++i) ++count[cell_of(t, t->p[i])];
+    for(r = 0; r < t->ch; ++r){
+        for(c = 0; c < t->cw; ){
+            int k = c + r*t->cw;
+            if(count[k] || !(all || t->tracked[k])){
+                ++c;
+                continue;
+            }
+            int e = c + 1;
+            while(e < t->cw && !count[e + r*t->cw] && (all || t->tracked[e + r*t->cw])) ++e;
+            detect_span(t, im, r, c, e);
+            c = e;
+        }
+    }
+    for(i = 0; i < t->n; ++i) t->tracked[cell_of(t, t->p[i])] = 1;
+    free(count);
+}
+
+// Start tracking the corners of a frame.
+// image im: the first frame.
+// returns: the tracker, free with free_klt_tracker.
+klt_tracker make_klt_tracker(image im)
+{
+    klt_tracker t = {0};
+    t.params = get_klt_params();
+    t.prev = make_image_pyramid(im, t.params.levels);
+    t.cw = MAX(1, (im.w + t.params.cell - 1) / t.params.cell);
+    t.ch = MAX(1, (im.h + t.params.cell - 1) / t.params.cell);
+    t.tracked = calloc(t.cw*t.ch, 1);
+    detect_tracks(&t, im, 1);
+    return t;
+}
+
+// Follow every track into the next frame. Each point is tracked from the
+// last frame into this one and back again, and kept if both windows are
+// well conditioned and it comes back to within params.fb pixels of where
+// it started. Every params.redetect frames, cells that lost their tracks
+// are searched for new corners. Besides the pyramid of the frame, work is
+// per track.
+// klt_tracker *t: tracker to update.
+// image im: the next frame, the same size as the first.
+// returns: number of tracks dropped.
+int klt_track(klt_tracker *t, image im)
+{
+    klt_params p = t->params;
+    image_pyramid cur = make_image_pyramid(im, p.levels);
+    unsigned char *keep = malloc(t->n ? t->n : 1);
+    int i;
+    #pragma omp parallel
+    {
+        float *scratch = make_track_scratch(p.window);
+        int k;
+        #pragma omp for
+        for(k = 0; k < t->n; ++k){
+            float x = t->p[k].x, y = t->p[k].y;
+            float d[2] = {0, 0};
+            keep[k] = 0;
+            if(!track_point_scratch(t->prev, cur, x, y, p.window, p.iters, d, scratch)) continue;
+            float b[2] = {-d[0], -d[1]};
+            if(!track_point_scratch(cur, t->prev, x + d[0], y + d[1], p.window, p.iters, b, scratch)) continue;
+            float ex = d[0] + b[0], ey = d[1] + b[1];
+            if(ex*ex + ey*ey > p.fb*p.fb) continue;
+            t->p[k].x = x + d[0];
+            t->p[k].y = y + d[1];
+            keep[k] = 1;
+        }
+        free(scratch);
+    }
+    int n = 0, lost;
+    for(i = 0; i < t->n; ++i){
+        if(!keep[i]) continue;
+        t->p[n] = t->p[i];
+        t->id[n] = t->id[i];
+        t->age[n] = t->age[i] + 1;
+        ++n;
+    }
+    lost = t->n - n;
+    t->n = n;
+    for(i = 0; i < n; ++i) t->tracked[cell_of(t, t->p[i])] = 1;
+    free(keep);
+    free_image_pyramid(t->prev);
+    t->prev = cur;
+    if(++t->frame % MAX(1, p.redetect) == 0) detect_tracks(t, im, 0);
+    return lost;
+}
+
+void free_klt_tracker(klt_tracker t)
+{
+    free(t.p);
+    free(t.id);
+    free(t.age);
+    free(t.tracked);
+    free_image_pyramid(t.prev);
+}
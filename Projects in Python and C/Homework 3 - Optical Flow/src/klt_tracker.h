@@ -0,0 +1,63 @@
+#ifndef KLT_TRACKER_H
+#define KLT_TRACKER_H
+#include "image.h"
+#include "pyramid_flow.h"
+
+// How a klt_tracker finds and follows points.
+// float sigma: std. dev for harris.
+// float thresh: threshold for cornerness.
+// int nms: distance to look for local-maxes, and the closest a new track
+//          may start to one already followed.
+// int window: Lucas-Kanade window size, at every pyramid level.
+// int levels: pyramid levels.
+// int iters: most refinement steps per level.
+// float fb: largest distance, in pixels, between a point and where it
+//           comes back to when tracked forward and then backward.
+// int cell: side of the square cells tracks are counted in.
+// int redetect: frames between looks for new corners, 1 for every frame.
+typedef struct{
+    float sigma;
+    float thresh;
+    int nms;
+    int window;
+    int levels;
+    int iters;
+    float fb;
+    int cell;
+    int redetect;
+} klt_params;
+
+// Harris corners followed from frame to frame. Points that cannot be
+// followed are dropped, and new corners are only looked for in cells that
+// once held a track and hold none now.
+// klt_params params: settings, from get_klt_params when made.
+// int n: number of tracks.
+// point *p: where each track is in the last frame.
+// int *id: each track's id, never reused.
+// int *age: frames each track has been followed for.
+// int next_id: id of the next new track.
+// int frame: frames seen.
+// image_pyramid prev: pyramid of the last frame.
+// int cw, ch: cells across and down the frame.
+// unsigned char *tracked: cells that have held a track.
+typedef struct{
+    klt_params params;
+    int n, size;
+    point *p;
+    int *id;
+    int *age;
+    int next_id;
+    int frame;
+    image_pyramid prev;
+    int cw, ch;
+    unsigned char *tracked;
+} klt_tracker;
+
+void set_klt_params(klt_params p);
+klt_params get_klt_params();
+
+klt_tracker make_klt_tracker(image im);
+int klt_track(klt_tracker *t, image im);
+void free_klt_tracker(klt_tracker t);
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "image.h"
+#include "time_structure.h"
+#include "pyramid_flow.h"
+
+// Levels are not halved below this many pixels on their short side, where
+// a window would cover most of the frame.
+#define PYRAMID_SMALLEST 8
+// Refinement at a level stops once an update moves less than this, in
+// pixels of that level.
+#define TRACK_EPSILON .01f
+
+// Levels and refinement steps optical_flow_images uses.
+static flow_params flow_settings = {1, 1};
+
+// Choose how optical_flow_images estimates flow, for every later call.
+void set_flow_params(flow_params p)
+{
+    flow_settings = p;
+}
+
+flow_params get_flow_params()
+{
+    return flow_settings;
+}
+
+// Blur a gray image with the separable [1 4 6 4 1] / 16 binomial filter,
+// clamped at the borders, and keep every other pixel. Rows are filtered
+// only at the columns kept, then the columns only at the rows kept.
+// image im: one channel image.
+// returns: (im.w + 1) / 2 x (im.h + 1) / 2 image, pixel (i, j) centred on
+//          pixel (2i, 2j) of im.
+static image pyramid_reduce(image im)
+{
+    int w = (im.w + 1) / 2, h = (im.h + 1) / 2, y;
+    image half = make_image(w, im.h, 1);
+    image out = make_image(w, h, 1);
+    #pragma omp parallel for
+    for(y = 0; y < im.h; ++y){
+        const float *r = im.data + (size_t)y*im.w;
+        float *d = half.data + (size_t)y*w;
+        int i;
+        for(i = 0; i < w; ++i){
+            int x = 2*i;
+            float a = r[MAX(x - 2, 0)], b = r[MAX(x - 1, 0)];
+            float c = r[MIN(x + 1, im.w - 1)], e = r[MIN(x + 2, im.w - 1)];
+            d[i] = (a + e + 4*(b + c) + 6*r[x]) / 16;
+        }
+    }
+    #pragma omp parallel for
+    for(y = 0; y < h; ++y){
+        int x = 2*y, i;
+        const float *a = half.data + (size_t)MAX(x - 2, 0)*w;
+        const float *b = half.data + (size_t)MAX(x - 1, 0)*w;
+        const float *c = half.data + (size_t)x*w;
+        const float *d = half.data + (size_t)MIN(x + 1, im.h - 1)*w;
+        const float *e = half.data + (size_t)MIN(x + 2, im.h - 1)*w;
+        float *o = out.data + (size_t)y*w;
+        for(i = 0; i < w; ++i) o[i] = (a[i] + e[i] + 4*(b[i] + d[i]) + 6*c[i]) / 16;
+    }
+    free_image(half);
+    return out;
+}
+
+// Build the Gaussian pyramid of a frame, in gray. Fewer levels are made if
+// the frame is too small to halve that often.
+// image im: frame, gray or RGB.
+// int levels: number of levels wanted.
+// returns: the pyramid, free with free_image_pyramid.
+image_pyramid make_image_pyramid(image im, int levels)
+{
+    image_pyramid p;
+    int n = 1, small = MIN(im.w, im.h);
+    while(n < levels && (small + 1) / 2 >= PYRAMID_SMALLEST){
+        small = (small + 1) / 2;
+        ++n;
+    }
+    p.levels = n;
+    p.level = calloc(n, sizeof(image));
+    if(im.c == 3){
+        p.level[0] = rgb_to_grayscale(im);
+    } else {
+        p.level[0] = make_image(im.w, im.h, 1);
+        memcpy(p.level[0].data, im.data, (size_t)im.w*im.h*sizeof(float));
+    }
+    int l;
+    for(l = 1; l < n; ++l) p.level[l] = pyramid_reduce(p.level[l - 1]);
+    return p;
+}
+
+void free_image_pyramid(image_pyramid p)
+{
+    int l;
+    for(l = 0; l < p.levels; ++l) free_image(p.level[l]);
+    free(p.level);
+}
+
+// Pixel (x, y) of a gray image, read bilinearly and clamped to the image.
+static inline float sample_clamped(image im, float x, float y)
+{
+    x = MIN(MAX(x, 0), im.w - 1);
+    y = MIN(MAX(y, 0), im.h - 1);
+    int i = x, j = y;
+    int i1 = MIN(i + 1, im.w - 1), j1 = MIN(j + 1, im.h - 1);
+    float a = x - i, b = y - j;
+    const float *r0 = im.data + (size_t)j*im.w, *r1 = im.data + (size_t)j1*im.w;
+    float top = (1 - a)*r0[i] + a*r0[i1];
+    float bot = (1 - a)*r1[i] + a*r1[i1];
+    return (1 - b)*top + b*bot;
+}
+
+// The n x n pixels of a gray image from (x, y) on, read bilinearly. Every
+// pixel shares the same weights, so windows inside the image are read
+// straight from its rows and only those over the border are clamped.
+// float *out: filled with the window, row by row.
+static void sample_window(image im, float x, float y, int n, float *out)
+{
+    float fx = floorf(x), fy = floorf(y);
+    int x0 = fx, y0 = fy, i, j;
+    if(x < 0 || y < 0 || x0 + n >= im.w || y0 + n >= im.h){
+        for(j = 0; j < n; ++j){
+            for(i = 0; i < n; ++i) out[i + j*n] = sample_clamped(im, x + i, y + j);
+        }
+        return;
+    }
+    float a = x - fx, b = y - fy;
+    float w00 = (1 - a)*(1 - b), w10 = a*(1 - b), w01 = (1 - a)*b, w11 = a*b;
+    for(j = 0; j < n; ++j){
+        const float *r0 = im.data + (size_t)(y0 + j)*im.w + x0, *r1 = r0 + im.w;
+        float *o = out + j*n;
+        for(i = 0; i < n; ++i) o[i] = w00*r0[i] + w10*r0[i + 1] + w01*r1[i] + w11*r1[i + 1];
+    }
+}
+
+// Find where the window around a point of one frame went in another, by
+// iterative Lucas-Kanade from the coarsest level of their pyramids down.
+// At each level the window is cut from the first frame once, with its
+// gradients and structure matrix, and the second frame is resampled at the
+// window moved by the displacement so far until the update drops below
+// TRACK_EPSILON or iters run out. The whole window moves with the one
+// displacement, so every point refines on its own.
+// image_pyramid from: pyramid of the frame the point is in.
+// image_pyramid to: pyramid of the frame to find it in.
+// float x, y: the point, in pixels of the full resolution frame.
+// int s: window size at every level.
+// int iters: most refinement steps per level.
+// float *d: displacement, read as a first guess and filled with the
+//           result, such that to(p + d) matches from(p) around the point.
+// returns: 1 if the window is well conditioned at full resolution and the
+//          point lands inside the frame, 0 if it is lost.
+int track_point(image_pyramid from, image_pyramid to, float x, float y, int s, int iters, float *d)
+{
+    float *scratch = make_track_scratch(s);
+    int ok = track_point_scratch(from, to, x, y, s, iters, d, scratch);
+    free(scratch);
+    return ok;
+}
+
+// Scratch for track_point_scratch with windows of s pixels.
+// returns: the scratch, free with free.
+float *make_track_scratch(int s)
+{
+    return malloc(((size_t)(s + 2)*(s + 2) + (size_t)3*s*s)*sizeof(float));
+}
+
+// track_point on scratch from make_track_scratch(s), so callers tracking
+// many points allocate it once per thread.
+// float *scratch: scratch not in use by any other call.
+int track_point_scratch(image_pyramid from, image_pyramid to, float x, float y, int s, int iters, float *d, float *scratch)
+{
+    assert(from.levels == to.levels);
+    int lo = s / 2, n = s + 2, ok = 0, l, k, i, j;
+    float *t = scratch;
+    float *g = t + (size_t)n*n;
+    float *r = g + (size_t)2*s*s;
+    float dx = d[0] / (1 << (from.levels - 1)), dy = d[1] / (1 << (from.levels - 1));
+    for(l = from.levels - 1; l >= 0; --l){
+        image a = from.level[l], b = to.level[l];
+        float cx = x / (1 << l) - lo, cy = y / (1 << l) - lo;
+        // With a border of one pixel for the Sobel filter.
+        sample_window(a, cx - 1, cy - 1, n, t);
+        float q[FLOW_PRODUCTS] = {0};
+        for(j = 0; j < s; ++j){
+            for(i = 0; i < s; ++i){
+                const float *p = t + (i + 1) + (j + 1)*n;
+                float gx = ((p[1 - n] - p[-1 - n]) + 2*(p[1] - p[-1]) + (p[1 + n] - p[-1 + n])) / 8;
+                float gy = ((p[n - 1] + 2*p[n] + p[n + 1]) - (p[-n - 1] + 2*p[-n] + p[-n + 1])) / 8;
+                g[2*(i + j*s)] = gx;
+                g[2*(i + j*s) + 1] = gy;
+                q[0] += gx*gx;
+                q[1] += gy*gy;
+                q[2] += gx*gy;
+            }
+        }
+        for(k = 0; k < iters; ++k){
+            float ux, uy;
+            q[3] = q[4] = 0;
+            sample_window(b, cx + dx, cy + dy, s, r);
+            for(j = 0; j < s; ++j){
+                for(i = 0; i < s; ++i){
+                    float e = r[i + j*s] - t[(i + 1) + (j + 1)*n];
+                    q[3] += g[2*(i + j*s)]*e;
+                    q[4] += g[2*(i + j*s) + 1]*e;
+                }
+            }
+            solve_velocity(q, 1, 1, FLOW_PRODUCTS, &ux, &uy);
+            dx += ux;
+            dy += uy;
+            if(ux*ux + uy*uy < TRACK_EPSILON*TRACK_EPSILON) break;
+        }
+        if(l > 0){
+            dx *= 2;
+            dy *= 2;
+        } else {
+            float det = q[0]*q[1] - q[2]*q[2], tr = q[0] + q[1];
+            ok = det > FLOW_CONDITION*tr*tr && det > 0;
+        }
+    }
+    d[0] = dx;
+    d[1] = dy;
+    image top = from.level[0];
+    ok = ok && x + dx >= 0 && x + dx <= top.w - 1 && y + dy >= 0 && y + dy <= top.h - 1;
+    return ok;
+}
+
+// Coarse to fine Lucas-Kanade flow at every stride-th pixel, each sample's
+// window tracked from the current frame back into the previous one with
+// track_point, on scratch allocated once per thread. A motion of m pixels
+// is found with windows of s pixels as long as m >> (levels - 1) is small,
+// and the full resolution frames are only read in the windows.
+// image_pyramid im: pyramid of the current frame.
+// image_pyramid prev: pyramid of the previous frame.
+// int s: window size at every level.
+// int stride: pixels between samples.
+// int iters: most refinement steps per level.
+// returns: im.w/stride x im.h/stride x 3 flow, like velocity_image.
+image pyramid_flow(image_pyramid im, image_pyramid prev, int s, int stride, int iters)
+{
+    image top = im.level[0];
+    image v = make_image(top.w / stride, top.h / stride, 3);
+    int off = (stride - 1) / 2;
+    #pragma omp parallel
+    {
+        float *scratch = make_track_scratch(s);
+        int j;
+        #pragma omp for
+        for(j = 0; j < v.h; ++j){
+            int i;
+            for(i = 0; i < v.w; ++i){
+                float d[2] = {0, 0};
+                track_point_scratch(im, prev, off + i*stride, off + j*stride, s, iters, d, scratch);
+                v.data[i + j*v.w] = -d[0];
+                v.data[i + j*v.w + v.w*v.h] = -d[1];
+            }
+        }
+        free(scratch);
+    }
+    return v;
+}
@@ -0,0 +1,36 @@
+#ifndef PYRAMID_FLOW_H
+#define PYRAMID_FLOW_H
+#include "image.h"
+
+// How optical_flow_images estimates flow.
+// int levels: pyramid levels, each half the size of the one before. 1 is
+//             single scale Lucas-Kanade, which only follows motions of a
+//             pixel or two; each level doubles that.
+// int iters: most refinement steps at every level.
+typedef struct{
+    int levels;
+    int iters;
+} flow_params;
+
+// Gray frame at successively halved resolutions, level[0] the full size.
+// Kept from one frame to the next, a frame's pyramid serves as the
+// previous frame's for the following one.
+// int levels: number of levels.
+// image *level: the levels, one channel each.
+typedef struct{
+    int levels;
+    image *level;
+} image_pyramid;
+
+void set_flow_params(flow_params p);
+flow_params get_flow_params();
+
+image_pyramid make_image_pyramid(image im, int levels);
+void free_image_pyramid(image_pyramid p);
+int track_point(image_pyramid from, image_pyramid to, float x, float y, int s, int iters, float *d);
+float *make_track_scratch(int s);
+int track_point_scratch(image_pyramid from, image_pyramid to, float x, float y, int s, int iters, float *d, float *scratch);
+image pyramid_flow(image_pyramid im, image_pyramid prev, int s, int stride, int iters);
+image optical_flow_pyramids(image_pyramid im, image_pyramid prev, int smooth, int stride);
+
+#endif
@@ -6,6 +6,10 @@
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "integral_image.h"
+#include "time_structure.h"
+#include "pyramid_flow.h"
+#include "klt_tracker.h"
 
 void feature_normalize2(image im)
 {
@@ -384,6 +388,351 @@ void test_cornerness()
     free_image(gt);
 }
 
+static image random_image(int w, int h, int c)
+{
+    image im = make_image(w, h, c);
+    int i;
+    for(i = 0; i < w*h*c; ++i) im.data[i] = (float)rand() / RAND_MAX;
+    return im;
+}
+
+// Mean over the s x s window around each pixel, clipped to the image.
+static image box_filter_reference(image im, int s)
+{
+    image S = make_image(im.w, im.h, im.c);
+    int i, j, k, x, y;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < im.h; ++j){
+            for(i = 0; i < im.w; ++i){
+                double sum = 0;
+                int count = 0;
+                for(y = MAX(0, j - s/2); y < MIN(im.h, j - s/2 + s); ++y){
+                    for(x = MAX(0, i - s/2); x < MIN(im.w, i - s/2 + s); ++x){
+                        sum += im.data[x + im.w*(y + im.h*k)];
+                        ++count;
+                    }
+                }
+                S.data[i + im.w*(j + im.h*k)] = sum / count;
+            }
+        }
+    }
+    return S;
+}
+
+void test_integral_image()
+{
+    srand(1);
+    image im = random_image(37, 23, 3);
+    image integ = make_integral_image(im);
+    int i, j, k, x, y, exact = 1;
+    for(k = 0; k < im.c; ++k){
+        for(j = 0; j < im.h; j += 5){
+            for(i = 0; i < im.w; i += 3){
+                double sum = 0;
+                for(y = 0; y <= j; ++y){
+                    for(x = 0; x <= i; ++x) sum += get_pixel(im, x, y, k);
+                }
+                exact &= fabs(get_pixel(integ, i, j, k) - sum) < 1e-3;
+            }
+        }
+    }
+    TEST(exact);
+
+    summed_table t = make_summed_table(im, INTEGRAL_DOUBLE);
+    double sum = 0;
+    for(y = 2; y < 11; ++y){
+        for(x = 4; x < 9; ++x) sum += get_pixel(im, x, y, 1);
+    }
+    TEST(within_eps(window_sum(t, 1, 4, 2, 9, 11), sum));
+    free_summed_table(t);
+    free_image(integ);
+    free_image(im);
+}
+
+void test_box_filter()
+{
+    srand(2);
+    image im = random_image(41, 30, 2);
+    int sizes[] = {1, 4, 7, 15, 64};
+    int i;
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i){
+        image gt = box_filter_reference(im, sizes[i]);
+        set_integral_precision(INTEGRAL_FLOAT);
+        image f = box_filter_image(im, sizes[i]);
+        set_integral_precision(INTEGRAL_DOUBLE);
+        image d = box_filter_image(im, sizes[i]);
+        TEST(same_image(f, gt) && same_image(d, gt));
+        free_image(gt);
+        free_image(f);
+        free_image(d);
+    }
+    set_integral_precision(INTEGRAL_FLOAT);
+    free_image(im);
+
+    // On a large bright frame, small windows are the difference of large
+    // totals, which a double table keeps.
+    image big = make_image(3000, 2000, 1);
+    for(i = 0; i < big.w*big.h; ++i) big.data[i] = 1 + (i % 7)*.001;
+    summed_table t = make_summed_table(big, INTEGRAL_DOUBLE);
+    double expect = 0;
+    int x, y;
+    for(y = 1990; y < 1993; ++y){
+        for(x = 2990; x < 2993; ++x) expect += big.data[x + big.w*y];
+    }
+    TEST(fabs(window_sum(t, 0, 2990, 1990, 2993, 1993) - expect) < 1e-6);
+    free_summed_table(t);
+    free_image(big);
+}
+
+// Time-structure matrix from separate passes: gray frames, Sobel
+// gradients, the five products and a box filter.
+static image time_structure_reference(image im, image prev, int s)
+{
+    image a = rgb_to_grayscale(im), b = rgb_to_grayscale(prev);
+    image gx = make_gx_filter(), gy = make_gy_filter();
+    image Ix = convolve_image(a, gx, 0), Iy = convolve_image(a, gy, 0);
+    image T = make_image(im.w, im.h, 5);
+    int n = im.w*im.h, i;
+    for(i = 0; i < n; ++i){
+        float x = Ix.data[i] / 8, y = Iy.data[i] / 8, t = a.data[i] - b.data[i];
+        T.data[i] = x*x;
+        T.data[i + n] = y*y;
+        T.data[i + 2*n] = x*y;
+        T.data[i + 3*n] = x*t;
+        T.data[i + 4*n] = y*t;
+    }
+    image S = box_filter_image(T, s);
+    free_image(a); free_image(b); free_image(gx); free_image(gy);
+    free_image(Ix); free_image(Iy); free_image(T);
+    return S;
+}
+
+void test_time_structure()
+{
+    srand(4);
+    image im = random_image(53, 38, 3), prev = random_image(53, 38, 3);
+    // Overlapping windows are streamed, the others summed in place.
+    int cases[][2] = {{1, 1}, {6, 1}, {15, 1}, {90, 1}, {6, 4}, {15, 4}, {3, 8}, {8, 8}, {1, 4}};
+    int i, j, k, n;
+    for(n = 0; n < sizeof(cases)/sizeof(cases[0]); ++n){
+        int size = cases[n][0], stride = cases[n][1], off = (stride - 1)/2, same = 1;
+        image gt = time_structure_reference(im, prev, size);
+        image S = time_structure_samples(im, prev, size, stride);
+        TEST(S.w == im.w/stride && S.h == im.h/stride && S.c == 5);
+        for(k = 0; k < 5; ++k){
+            for(j = 0; j < S.h; ++j){
+                for(i = 0; i < S.w; ++i){
+                    same &= within_eps(get_pixel(S, i, j, k), get_pixel(gt, off + i*stride, off + j*stride, k));
+                }
+            }
+        }
+        TEST(same);
+        free_image(gt);
+        free_image(S);
+    }
+    image gt = time_structure_reference(im, prev, 7);
+    image S = time_structure_matrix(im, prev, 7);
+    TEST(same_image(S, gt));
+    free_image(gt);
+    free_image(S);
+    free_image(im);
+    free_image(prev);
+}
+
+// A smooth pattern moved by (dx, dy) pixels.
+static image wave_image(int w, int h, float dx, float dy)
+{
+    image im = make_image(w, h, 1);
+    int i, j;
+    for(j = 0; j < h; ++j){
+        for(i = 0; i < w; ++i){
+            float x = i - dx, y = j - dy;
+            im.data[i + w*j] = .5 + .2*sinf(x/6 + y/11) + .2*cosf(y/7 - x/13);
+        }
+    }
+    return im;
+}
+
+void test_velocity()
+{
+    image prev = wave_image(96, 80, 0, 0), im = wave_image(96, 80, .4, -.25);
+    image S = time_structure_samples(im, prev, 15, 8);
+    image v = velocity_image(S, 1);
+    double vx = 0, vy = 0;
+    int i, j, n = 0;
+    // Away from the clipped border windows.
+    for(j = 2; j < v.h - 2; ++j){
+        for(i = 2; i < v.w - 2; ++i){
+            vx += get_pixel(v, i, j, 0);
+            vy += get_pixel(v, i, j, 1);
+            ++n;
+        }
+    }
+    TEST(fabs(vx/n - .4) < .04 && fabs(vy/n + .25) < .04);
+
+    // No velocity where the image is flat.
+    image flat = make_image(40, 40, 1);
+    image F = time_structure_samples(flat, flat, 9, 8);
+    image u = velocity_image(F, 1);
+    float most = 0;
+    for(i = 0; i < u.w*u.h*u.c; ++i) most = MAX(most, fabs(u.data[i]));
+    TEST(most == 0);
+
+    // Strided reads of a dense matrix give the same velocities.
+    image D = time_structure_matrix(im, prev, 15);
+    image w = velocity_image(D, 8);
+    TEST(same_image(w, v));
+
+    free_image(flat);
+    free_image(F);
+    free_image(u);
+    free_image(D);
+    free_image(w);
+    free_image(S);
+    free_image(v);
+    free_image(im);
+    free_image(prev);
+}
+
+void test_pyramid_flow()
+{
+    image prev = wave_image(160, 128, 0, 0), im = wave_image(160, 128, 5.5, -3.2);
+    image_pyramid a = make_image_pyramid(im, 4), b = make_image_pyramid(prev, 4);
+    TEST(a.levels == 4 && a.level[3].w == 20 && a.level[3].h == 16);
+    image box = make_box_filter(20);
+    image_pyramid tiny = make_image_pyramid(box, 6);
+    TEST(tiny.levels == 2 && tiny.level[1].w == 10);
+
+    // Too far for one scale, followed from the coarsest level down.
+    image v = pyramid_flow(a, b, 9, 8, 3);
+    image_pyramid a1 = make_image_pyramid(im, 1), b1 = make_image_pyramid(prev, 1);
+    image one = pyramid_flow(a1, b1, 9, 8, 1);
+    TEST(v.w == 20 && v.h == 16 && v.c == 3);
+    int i, j, n = 0, lost = 0;
+    float most = 0;
+    // Away from the border, where windows are clamped.
+    for(j = 2; j < v.h - 2; ++j){
+        for(i = 2; i < v.w - 2; ++i){
+            most = MAX(most, fabs(get_pixel(v, i, j, 0) - 5.5));
+            most = MAX(most, fabs(get_pixel(v, i, j, 1) + 3.2));
+            lost += fabs(get_pixel(one, i, j, 0) - 5.5) > 1;
+            ++n;
+        }
+    }
+    TEST(most < .1);
+    TEST(lost > n/2);
+
+    // One level and one step is single scale Lucas-Kanade, where windows
+    // are not clamped at the border.
+    image small = wave_image(160, 128, .4, -.25);
+    image_pyramid c1 = make_image_pyramid(small, 1);
+    image u = pyramid_flow(c1, b1, 9, 8, 1);
+    image S = time_structure_samples(small, prev, 9, 8);
+    image lk = velocity_image(S, 1);
+    int same = 1;
+    for(j = 1; j < u.h - 1; ++j){
+        for(i = 1; i < u.w - 1; ++i){
+            same &= within_eps(get_pixel(u, i, j, 0), get_pixel(lk, i, j, 0));
+            same &= within_eps(get_pixel(u, i, j, 1), get_pixel(lk, i, j, 1));
+        }
+    }
+    TEST(same);
+
+    // A point on a corner is followed, one in a flat region is lost.
+    image corner = make_image(64, 64, 1), moved = make_image(64, 64, 1);
+    for(j = 0; j < 64; ++j){
+        for(i = 0; i < 64; ++i){
+            set_pixel(corner, i, j, 0, i >= 30 && j >= 30);
+            set_pixel(moved, i, j, 0, i >= 36 && j >= 34);
+        }
+    }
+    image_pyramid p0 = make_image_pyramid(corner, 3), p1 = make_image_pyramid(moved, 3);
+    float d[2] = {0, 0}, e[2] = {0, 0};
+    TEST(track_point(p0, p1, 30, 30, 9, 10, d));
+    TEST(fabs(d[0] - 6) < .2 && fabs(d[1] - 4) < .2);
+    TEST(!track_point(p0, p1, 10, 10, 9, 10, e));
+
+    free_image(small);
+    free_image(u);
+    free_image(S);
+    free_image(lk);
+    free_image(corner);
+    free_image(moved);
+    free_image_pyramid(c1);
+    free_image_pyramid(p0);
+    free_image_pyramid(p1);
+    free_image(v);
+    free_image(one);
+    free_image_pyramid(a);
+    free_image_pyramid(b);
+    free_image_pyramid(a1);
+    free_image_pyramid(b1);
+    free_image_pyramid(tiny);
+    free_image(box);
+    free_image(im);
+    free_image(prev);
+}
+
+// Bright 10 x 10 squares on black, moved by (dx, dy). Square skip is left
+// out, and square 5 is only drawn if extra is set.
+static image squares_image(int dx, int dy, int skip, int extra)
+{
+    image im = make_image(128, 96, 1);
+    int xs[] = {20, 60, 90, 30, 75, 100}, ys[] = {20, 15, 30, 60, 65, 75};
+    int k, i, j;
+    for(k = 0; k < 5 + extra; ++k){
+        if(k == skip) continue;
+        for(j = 0; j < 10; ++j){
+            for(i = 0; i < 10; ++i) set_pixel(im, xs[k] + dx + i, ys[k] + dy + j, 0, 1);
+        }
+    }
+    return im;
+}
+
+void test_klt_tracker()
+{
+    klt_params old = get_klt_params(), p = old;
+    p.cell = 16;
+    p.redetect = 1;
+    p.thresh = 1;
+    set_klt_params(p);
+    image a = squares_image(0, 0, -1, 0);
+    klt_tracker t = make_klt_tracker(a);
+    TEST(t.n == 20);
+    point start[20];
+    int i, n = t.n;
+    for(i = 0; i < n; ++i) start[i] = t.p[i];
+
+    // Every corner follows a move of several pixels and keeps its id.
+    image b = squares_image(6, -4, -1, 0);
+    TEST(klt_track(&t, b) == 0);
+    int moved = t.n == n;
+    for(i = 0; i < t.n && moved; ++i){
+        moved &= t.id[i] == i && t.age[i] == 1;
+        moved &= fabs(t.p[i].x - start[i].x - 6) < .1 && fabs(t.p[i].y - start[i].y + 4) < .1;
+    }
+    TEST(moved);
+
+    // A square that goes away takes its tracks with it...
+    image c = squares_image(6, -4, 1, 0);
+    TEST(klt_track(&t, c) == 4 && t.n == 16);
+
+    // ...and its corners are found again when it is back, with new ids.
+    // A square where nothing was ever tracked is not looked for.
+    image d = squares_image(6, -4, -1, 1);
+    TEST(klt_track(&t, d) == 0 && t.n == 20);
+    int fresh = 0;
+    for(i = 0; i < t.n; ++i) fresh += t.id[i] >= 20 && t.age[i] == 0 && t.p[i].x > 60 && t.p[i].x < 80;
+    TEST(fresh == 4 && t.next_id == 24);
+
+    free_klt_tracker(t);
+    free_image(a);
+    free_image(b);
+    free_image(c);
+    free_image(d);
+    set_klt_params(old);
+}
+
 void run_tests()
 {
     //test_matrix();
@@ -408,6 +757,12 @@ void run_tests()
     test_sobel();
     test_structure();
     test_cornerness();
+    test_integral_image();
+    test_box_filter();
+    test_time_structure();
+    test_velocity();
+    test_pyramid_flow();
+    test_klt_tracker();
     printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
 }
 
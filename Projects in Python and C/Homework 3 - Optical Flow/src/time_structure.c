@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+#include "time_structure.h"
+
+// Image rows each thread streams through at once. Every band rereads the
+// s - 1 rows before it, so bands are kept long next to the window.
+#define FLOW_BAND 128
+
+// Pixels a <= i < b of an image row in gray, like rgb_to_grayscale.
+static void gray_pixels(const float *r, size_t plane, int a, int b, float *g)
+{
+    int i;
+    for(i = a; i < b; ++i) g[i] = .299f*r[i] + .587f*r[i + plane] + .114f*r[i + 2*plane];
+}
+
+// Row y of an image in gray, clamped to the image, converted if the image
+// has three channels. Converted rows are cached in buf by y % 3, which is
+// enough for the three rows a Sobel filter reads.
+// int *have: which row each third of buf holds.
+static const float *gray_row(image im, int y, float *buf, int *have)
+{
+    y = MIN(MAX(y, 0), im.h - 1);
+    const float *r = im.data + (size_t)y*im.w;
+    if(im.c != 3) return r;
+    float *g = buf + (y % 3)*im.w;
+    if(have[y % 3] != y){
+        gray_pixels(r, (size_t)im.w*im.h, 0, im.w, g);
+        have[y % 3] = y;
+    }
+    return g;
+}
+
+// Like gray_row, but only converting the columns that windows of s pixels
+// around every stride-th column, and their Sobel neighbours, cover.
+static const float *gray_windows(image im, int y, int s, int stride, float *buf, int *have)
+{
+    y = MIN(MAX(y, 0), im.h - 1);
+    const float *r = im.data + (size_t)y*im.w;
+    if(im.c != 3) return r;
+    float *g = buf + (y % 3)*im.w;
+    if(have[y % 3] != y){
+        int lo = s / 2, hi = s - lo, off = (stride - 1) / 2, n;
+        for(n = 0; n < im.w / stride; ++n){
+            int x = off + n*stride;
+            gray_pixels(r, (size_t)im.w*im.h, MAX(0, x - lo - 1), MIN(im.w, x + hi + 1), g);
+        }
+        have[y % 3] = y;
+    }
+    return g;
+}
+
+// The five products at column i of a row, from the gray rows above, at
+// and below it and the previous frame's row. Sobel responses are divided
+// by 8 so the gradients are in intensity per pixel. l and r are the
+// neighbouring columns, clamped.
+// float *q: filled with Ix^2, Iy^2, IxIy, IxIt, IyIt.
+static inline void products_at(const float *up, const float *mid, const float *down, const float *old,
+        int i, int l, int r, float *q)
+{
+    float ix = ((up[r] - up[l]) + 2*(mid[r] - mid[l]) + (down[r] - down[l])) / 8;
+    float iy = ((down[l] + 2*down[i] + down[r]) - (up[l] + 2*up[i] + up[r])) / 8;
+    float it = mid[i] - old[i];
+    q[0] = ix*ix;
+    q[1] = iy*iy;
+    q[2] = ix*iy;
+    q[3] = ix*it;
+    q[4] = iy*it;
+}
+
+// Products of a whole row, one plane of w floats each.
+static void product_row(const float *up, const float *mid, const float *down, const float *old, int w, float *p)
+{
+    int i, k, n;
+    float q[FLOW_PRODUCTS];
+    for(i = 1; i < w - 1; ++i){
+        products_at(up, mid, down, old, i, i - 1, i + 1, q);
+        for(k = 0; k < FLOW_PRODUCTS; ++k) p[i + k*w] = q[k];
+    }
+    int edge[2] = {0, w - 1};
+    for(n = 0; n < (w > 1 ? 2 : 1); ++n){
+        i = edge[n];
+        products_at(up, mid, down, old, i, MAX(i - 1, 0), MIN(i + 1, w - 1), q);
+        for(k = 0; k < FLOW_PRODUCTS; ++k) p[i + k*w] = q[k];
+    }
+}
+
+// One band of sampled rows of the time-structure matrix, read straight
+// from the two frames. Each image row becomes its five products, which are
+// added to running column sums and kept in a ring of s rows so they can be
+// taken out again once they leave the window. When a sampled row's window
+// is complete its column sums are summed along the row once and read at
+// the sampled columns. Windows are clipped at the borders like
+// box_filter_image.
+// int m0, m1: sampled rows to produce.
+// image S: filled with the sampled rows.
+static void structure_band(image im, image prev, int s, int stride, int m0, int m1, image S)
+{
+    int w = im.w, h = im.h, lo = s / 2, hi = s - lo, off = (stride - 1) / 2;
+    int n = FLOW_PRODUCTS*w;
+    float *ring = calloc((size_t)s*n, sizeof(float));
+    float *gray = malloc(3*w*sizeof(float));
+    float *old = malloc(3*w*sizeof(float));
+    double *col = calloc(n, sizeof(double));
+    double *pre = malloc((w + 1)*sizeof(double));
+    int have[3] = {-1, -1, -1}, had[3] = {-1, -1, -1};
+    int y0 = MAX(0, off + m0*stride - lo), y1 = off + (m1 - 1)*stride + hi;
+    int m = m0, y, i, c;
+    for(y = y0; y < y1; ++y){
+        float *p = ring + (size_t)((y - y0) % s)*n;
+        for(i = 0; i < n; ++i) col[i] -= p[i];
+        if(y < h){
+            const float *up = gray_row(im, y - 1, gray, have);
+            const float *mid = gray_row(im, y, gray, have);
+            const float *down = gray_row(im, y + 1, gray, have);
+            product_row(up, mid, down, gray_row(prev, y, old, had), w, p);
+            for(i = 0; i < n; ++i) col[i] += p[i];
+        } else {
+            memset(p, 0, n*sizeof(float));
+        }
+        int j = off + m*stride;
+        if(y < j + hi - 1) continue;
+        int rows = MIN(h, j + hi) - MAX(0, j - lo);
+        for(c = 0; c < FLOW_PRODUCTS; ++c){
+            const double *cs = col + c*w;
+            float *out = S.data + (size_t)c*S.w*S.h + (size_t)m*S.w;
+            pre[0] = 0;
+            for(i = 0; i < w; ++i) pre[i + 1] = pre[i] + cs[i];
+            for(i = 0; i < S.w; ++i){
+                int x = off + i*stride;
+                int x0 = MAX(0, x - lo), x1 = MIN(w, x + hi);
+                out[i] = (pre[x1] - pre[x0]) / (rows*(x1 - x0));
+            }
+        }
+        if(++m == m1) break;
+    }
+    free(ring);
+    free(gray);
+    free(old);
+    free(col);
+    free(pre);
+}
+
+// One band of sampled rows when windows do not overlap, s <= stride.
+// Products are only formed inside the windows and summed directly, so the
+// cost follows the number of samples times s^2 rather than the image area.
+static void structure_sparse(image im, image prev, int s, int stride, int m0, int m1, image S)
+{
+    int w = im.w, h = im.h, lo = s / 2, hi = s - lo, off = (stride - 1) / 2;
+    float *gray = malloc(3*w*sizeof(float));
+    float *old = malloc(3*w*sizeof(float));
+    double *acc = malloc((size_t)FLOW_PRODUCTS*S.w*sizeof(double));
+    int have[3] = {-1, -1, -1}, had[3] = {-1, -1, -1};
+    int m, n, x, y, k;
+    for(m = m0; m < m1; ++m){
+        int j = off + m*stride, y0 = MAX(0, j - lo), y1 = MIN(h, j + hi);
+        memset(acc, 0, (size_t)FLOW_PRODUCTS*S.w*sizeof(double));
+        for(y = y0; y < y1; ++y){
+            const float *up = gray_windows(im, y - 1, s, stride, gray, have);
+            const float *mid = gray_windows(im, y, s, stride, gray, have);
+            const float *down = gray_windows(im, y + 1, s, stride, gray, have);
+            const float *was = gray_windows(prev, y, s, stride, old, had);
+            for(n = 0; n < S.w; ++n){
+                int c = off + n*stride, x0 = MAX(0, c - lo), x1 = MIN(w, c + hi);
+                float sum[FLOW_PRODUCTS] = {0};
+                for(x = x0; x < x1; ++x){
+                    float q[FLOW_PRODUCTS];
+                    products_at(up, mid, down, was, x, MAX(x - 1, 0), MIN(x + 1, w - 1), q);
+                    for(k = 0; k < FLOW_PRODUCTS; ++k) sum[k] += q[k];
+                }
+                for(k = 0; k < FLOW_PRODUCTS; ++k) acc[n + k*S.w] += sum[k];
+            }
+        }
+        for(n = 0; n < S.w; ++n){
+            int c = off + n*stride, x0 = MAX(0, c - lo), x1 = MIN(w, c + hi);
+            float area = (y1 - y0)*(x1 - x0);
+            for(k = 0; k < FLOW_PRODUCTS; ++k){
+                S.data[(size_t)k*S.w*S.h + (size_t)m*S.w + n] = acc[n + k*S.w] / area;
+            }
+        }
+    }
+    free(gray);
+    free(old);
+    free(acc);
+}
+
+// Time-structure matrix at every stride-th pixel, the centres
+// velocity_image(S, stride) reads, computed in one pass over both frames.
+// Gradients, products and the box filter are fused, so neither the gray
+// frames nor the full resolution products are ever stored. Windows that
+// overlap are streamed over every row; windows that do not (s <= stride)
+// are summed where they are, skipping the pixels between them.
+// image im: the input image.
+// image prev: the previous image in sequence.
+// int s: window size for smoothing.
+// int stride: distance between samples, 1 for every pixel.
+// returns: im.w/stride x im.h/stride x 5 structure matrix, channels as in
+//          time_structure_matrix.
+image time_structure_samples(image im, image prev, int s, int stride)
+{
+    assert(im.w == prev.w && im.h == prev.h && im.c == prev.c);
+    image S = make_image(im.w / stride, im.h / stride, FLOW_PRODUCTS);
+    int per = MAX(1, FLOW_BAND / stride);
+    int bands = (S.h + per - 1) / per, b;
+    #pragma omp parallel for
+    for(b = 0; b < bands; ++b){
+        int m0 = b*per, m1 = MIN(S.h, (b + 1)*per);
+        if(s <= stride) structure_sparse(im, prev, s, stride, m0, m1, S);
+        else structure_band(im, prev, s, stride, m0, m1, S);
+    }
+    return S;
+}
+
+// Lucas-Kanade velocities of a run of samples from their time-structure
+// matrices, by the closed form inverse of the 2x2 system
+// [Ixx Ixy; Ixy Iyy] v = -[IxIt; IyIt], with no branches so it vectorizes.
+// const float *s: the first sample in the Ixx plane of a structure matrix.
+// size_t plane: floats between the planes.
+// int n: number of samples.
+// int step: floats between samples.
+// float *vx, *vy: filled with n velocities, 0 where the system is ill
+//                 conditioned.
+void solve_velocity(const float *s, size_t plane, int n, int step, float *vx, float *vy)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        const float *p = s + (size_t)i*step;
+        float xx = p[0], yy = p[plane], xy = p[2*plane], xt = p[3*plane], yt = p[4*plane];
+        float det = xx*yy - xy*xy, tr = xx + yy;
+        int ok = det > FLOW_CONDITION*tr*tr && det > 0;
+        float inv = ok / (ok ? det : 1);
+        vx[i] = (xy*yt - yy*xt)*inv;
+        vy[i] = (xy*xt - xx*yt)*inv;
+    }
+}
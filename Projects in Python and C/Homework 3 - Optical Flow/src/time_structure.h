@@ -0,0 +1,18 @@
+#ifndef TIME_STRUCTURE_H
+#define TIME_STRUCTURE_H
+#include <stddef.h>
+#include "image.h"
+
+// Products of the time-structure matrix: Ix^2, Iy^2, IxIy, IxIt, IyIt.
+#define FLOW_PRODUCTS 5
+// Samples whose structure matrix has det < FLOW_CONDITION * trace^2, whose
+// eigenvalues differ by more than about 1 / FLOW_CONDITION, are too close
+// to an edge or a flat patch for a velocity and get none.
+#define FLOW_CONDITION 1e-3f
+
+image time_structure_samples(image im, image prev, int s, int stride);
+image time_structure_matrix(image im, image prev, int s);
+image velocity_image(image S, int stride);
+void solve_velocity(const float *s, size_t plane, int n, int step, float *vx, float *vy);
+
+#endif
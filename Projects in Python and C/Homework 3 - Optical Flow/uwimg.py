@@ -27,6 +27,8 @@ class POINT(Structure):
 class DESCRIPTOR(Structure):
     _fields_ = [("p", POINT),
                 ("n", c_int),
+                ("kind", c_ubyte),
+                ("shared", c_ubyte),
                 ("data", POINTER(c_float))]
 
 add_image = lib.add_image
@@ -189,13 +191,29 @@ box_filter_image = lib.box_filter_image
 box_filter_image.argtypes = [IMAGE, c_int]
 box_filter_image.restype = IMAGE
 
-optical_flow_images = lib.optical_flow_images
-optical_flow_images.argtypes = [IMAGE, IMAGE, c_int, c_int]
-optical_flow_images.restype = IMAGE
+class FLOW_PARAMS(Structure):
+    _fields_ = [("levels", c_int),
+                ("iters", c_int)]
 
-optical_flow_webcam = lib.optical_flow_webcam
-optical_flow_webcam.argtypes = [c_int, c_int, c_int]
-optical_flow_webcam.restype = None
+set_flow_params = lib.set_flow_params
+set_flow_params.argtypes = [FLOW_PARAMS]
+set_flow_params.restype = None
+
+optical_flow_images_lib = lib.optical_flow_images
+optical_flow_images_lib.argtypes = [IMAGE, IMAGE, c_int, c_int]
+optical_flow_images_lib.restype = IMAGE
+
+def optical_flow_images(im, prev, smooth, stride, levels=1, iters=1):
+    set_flow_params(FLOW_PARAMS(levels, iters))
+    return optical_flow_images_lib(im, prev, smooth, stride)
+
+optical_flow_webcam_lib = lib.optical_flow_webcam
+optical_flow_webcam_lib.argtypes = [c_int, c_int, c_int]
+optical_flow_webcam_lib.restype = None
+
+def optical_flow_webcam(smooth, stride, div, levels=1, iters=1):
+    set_flow_params(FLOW_PARAMS(levels, iters))
+    return optical_flow_webcam_lib(smooth, stride, div)
 
 def panorama_image(a, b, sigma=2, thresh=5, nms=3, inlier_thresh=2, iters=10000, cutoff=30):
     return panorama_image_lib(a, b, sigma, thresh, nms, inlier_thresh, iters, cutoff)
@@ -1,7 +1,90 @@
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "image.h"
 #include "matrix.h"
+#include "gemm.h"
+
+// exp(x) without a libm call, so loops over rows vectorize.
+// x = n*ln2 + r with |r| <= ln2/2, exp(r) from its degree 11 Taylor
+// polynomial (relative error below 1e-14), 2^n built in the exponent bits.
+// Arguments are clamped to [-708, 709], the range of normal results.
+static inline double fast_exp(double x)
+{
+    const double shift = 0x1.8p52;
+    x = x < -708 ? -708 : (x > 709 ? 709 : x);
+    double n = rint(x*1.4426950408889634);
+    double r = x - n*6.93147180369123816490e-01 - n*1.90821492927058770002e-10;
+    double p = 1/39916800.;
+    p = p*r + 1/3628800.;
+    p = p*r + 1/362880.;
+    p = p*r + 1/40320.;
+    p = p*r + 1/5040.;
+    p = p*r + 1/720.;
+    p = p*r + 1/120.;
+    p = p*r + 1/24.;
+    p = p*r + 1/6.;
+    p = p*r + .5;
+    p = p*r + 1;
+    p = p*r + 1;
+    // The low mantissa bits of n + 1.5*2^52 hold n + 2^51, the shift
+    // drops the 2^51 and leaves n + 1023 in the exponent field.
+    double t = n + shift;
+    uint64_t bits;
+    memcpy(&bits, &t, sizeof(bits));
+    bits = (bits + 1023) << 52;
+    double s;
+    memcpy(&s, &bits, sizeof(s));
+    return p*s;
+}
+
+// Run an activation function over one row of outputs, in place.
+// double *x: the row.
+// int n: length of the row.
+// ACTIVATION a: function to run, SOFTMAX normalizes the whole row.
+static void activate_row(double *x, int n, ACTIVATION a)
+{
+    int j;
+    if(a == LOGISTIC){
+        for(j = 0; j < n; ++j) x[j] = 1/(1 + fast_exp(-x[j]));
+    } else if (a == RELU){
+        for(j = 0; j < n; ++j) x[j] = x[j] > 0 ? x[j] : 0;
+    } else if (a == LRELU){
+        for(j = 0; j < n; ++j) x[j] = x[j] > 0 ? x[j] : .1*x[j];
+    } else if (a == SOFTMAX){
+        // Subtract the max first so exp never overflows.
+        double max = x[0], sum = 0;
+        for(j = 1; j < n; ++j) max = x[j] > max ? x[j] : max;
+        for(j = 0; j < n; ++j){
+            x[j] = fast_exp(x[j] - max);
+            sum += x[j];
+        }
+        for(j = 0; j < n; ++j) x[j] /= sum;
+    }
+}
+
+// Multiply one row of deltas by the activation gradient, in place.
+// const double *y: activated outputs for the row.
+// double *d: deltas for the row.
+// int n: length of the row.
+// ACTIVATION a: activation that produced y.
+static void gradient_row(const double *y, double *d, int n, ACTIVATION a)
+{
+    int j;
+    if(a == LOGISTIC){
+        for(j = 0; j < n; ++j) d[j] *= y[j]*(1 - y[j]);
+    } else if (a == RELU){
+        for(j = 0; j < n; ++j) d[j] = y[j] > 0 ? d[j] : 0;
+    } else if (a == LRELU){
+        for(j = 0; j < n; ++j) d[j] = y[j] > 0 ? d[j] : .1*d[j];
+    }
+}
 
 // Run an activation function on each element in a matrix,
 // modifies the matrix in place
@@ -9,25 +92,9 @@
 // ACTIVATION a: function to run
 void activate_matrix(matrix m, ACTIVATION a)
 {
-    int i, j;
+    int i;
     for(i = 0; i < m.rows; ++i){
-        double sum = 0;
-        for(j = 0; j < m.cols; ++j){
-            double x = m.data[i][j];
-            if(a == LOGISTIC){
-                // TODO
-            } else if (a == RELU){
-                // TODO
-            } else if (a == LRELU){
-                // TODO
-            } else if (a == SOFTMAX){
-                // TODO
-            }
-            sum += m.data[i][j];
-        }
-        if (a == SOFTMAX) {
-            // TODO: have to normalize by sum if we are using SOFTMAX
-        }
+        activate_row(m.data[i], m.cols, a);
     }
 }
 
@@ -38,57 +105,92 @@ void activate_matrix(matrix m, ACTIVATION a)
 // matrix d: delta before activation gradient
 void gradient_matrix(matrix m, ACTIVATION a, matrix d)
 {
-    int i, j;
+    int i;
     for(i = 0; i < m.rows; ++i){
-        for(j = 0; j < m.cols; ++j){
-            double x = m.data[i][j];
-            // TODO: multiply the correct element of d by the gradient
-        }
+        gradient_row(m.data[i], d.data[i], m.cols, a);
     }
 }
 
+// gemm epilogue: activate each row of the output as soon as it is done.
+static void activate_hook(double *c, int row, int n, void *ctx)
+{
+    activate_row(c, n, *(ACTIVATION *)ctx);
+}
+
+typedef struct{
+    matrix out;
+    ACTIVATION a;
+} gradient_ctx;
+
+// gemm prologue: apply the activation gradient to delta as it is packed.
+static void gradient_hook(double *d, int row, int col, int n, void *ctx)
+{
+    gradient_ctx *g = ctx;
+    gradient_row(g->out.data[row] + col, d, n, g->a);
+}
+
+// Rows the inference path of forward_model runs through the layers at once.
+#define PREDICT_ROWS 256
+
+// Make room for a batch in a workspace of a layer. Workspaces only grow,
+// so once one fits the largest training batch nothing is allocated.
+// matrix *m: the workspace.
+// int *room: rows it has room for.
+// int rows: rows in the batch.
+// int cols: columns of the workspace.
+static void reserve_rows(matrix *m, int *room, int rows, int cols)
+{
+    if(rows > *room){
+        free_matrix(*m);
+        *m = make_matrix(rows, cols);
+        *room = rows;
+    }
+    // Rows are contiguous, so fewer rows is the same block.
+    m->rows = rows;
+}
+
 // Forward propagate information through a layer
+// The activation runs inside the multiply, on each block of output rows
+// while it is still in cache.
 // layer *l: pointer to the layer
 // matrix in: input to layer
-// returns: matrix that is output of the layer
+// returns: matrix that is output of the layer, owned by the layer and
+//          overwritten by the next forward pass
 matrix forward_layer(layer *l, matrix in)
 {
 
     l->in = in;  // Save the input for backpropagation
 
+    reserve_rows(&l->out, &l->batch, in.rows, l->w.cols);
+    gemm_hooks hooks = {0, activate_hook, &l->activation};
+    gemm_fused(0, 0, 1, in, l->w, 0, l->out, hooks);
 
-    // TODO: fix this! multiply input by weights and apply activation function.
-    matrix out = make_matrix(in.rows, l->w.cols);
-
-
-    free_matrix(l->out);// free the old output
-    l->out = out;       // Save the current output for gradient calculation
-    return out;
+    return l->out;
 }
 
 // Backward propagate derivatives through a layer
+// The activation gradient is applied to delta while dL/dw packs it, so
+// delta is only read from memory once before dL/dx reuses it.
 // layer *l: pointer to the layer
 // matrix delta: partial derivative of loss w.r.t. output of layer
-// returns: matrix, partial derivative of loss w.r.t. input to layer
+// returns: matrix, partial derivative of loss w.r.t. input to layer, owned
+//          by the layer and overwritten by the next backward pass
 matrix backward_layer(layer *l, matrix delta)
 {
-    // 1.4.1
-    // delta is dL/dy
-    // TODO: modify it in place to be dL/d(xw)
-
+    assert(delta.rows == l->out.rows && delta.cols == l->out.cols);
+    // 1.4.1 and 1.4.2
+    // delta is dL/dy, modified in place to be dL/d(xw) on its way into
+    // dL/dw = x^T dL/d(xw)
+    gradient_ctx g = {l->out, l->activation};
+    gemm_hooks hooks = {gradient_hook, 0, &g};
+    gemm_fused(1, 0, 1, l->in, delta, 0, l->dw, hooks);
 
-    // 1.4.2
-    // TODO: then calculate dL/dw and save it in l->dw
-    free_matrix(l->dw);
-    matrix dw = make_matrix(l->w.rows, l->w.cols); // replace this
-    l->dw = dw;
-
-    
     // 1.4.3
-    // TODO: finally, calculate dL/dx and return it.
-    matrix dx = make_matrix(l->in.rows, l->in.cols); // replace this
+    // dL/dx = dL/d(xw) w^T, only sized once a backward pass needs it
+    reserve_rows(&l->dx, &l->dx_batch, delta.rows, l->w.rows);
+    gemm(0, 1, 1, delta, l->w, 0, l->dx);
 
-    return dx;
+    return l->dx;
 }
 
 // Update the weights at layer l
@@ -98,16 +200,16 @@ matrix backward_layer(layer *l, matrix delta)
 // double decay: value for weight decay
 void update_layer(layer *l, double rate, double momentum, double decay)
 {
-    // TODO:
-    // Calculate Δw_t = dL/dw_t - λw_t + mΔw_{t-1}
-    // save it to l->v
-
-
-    // Update l->w
-
-
-    // Remember to free any intermediate results to avoid memory leaks
-
+    // Δw_t = dL/dw_t - λw_t + mΔw_{t-1}, saved to l->v, then w += ηΔw_t
+    int i, j;
+    for(i = 0; i < l->w.rows; ++i){
+        double *w = l->w.data[i], *v = l->v.data[i];
+        const double *dw = l->dw.data[i];
+        for(j = 0; j < l->w.cols; ++j){
+            v[j] = dw[j] - decay*w[j] + momentum*v[j];
+            w[j] += rate*v[j];
+        }
+    }
 }
 
 // Make a new layer for our model
@@ -122,15 +224,30 @@ layer make_layer(int input, int output, ACTIVATION activation)
     l.w   = random_matrix(input, output, sqrt(2./input));
     l.v   = make_matrix(input, output);
     l.dw  = make_matrix(input, output);
+    l.dx  = make_matrix(1,1);
+    l.batch = 0;
+    l.dx_batch = 0;
     l.activation = activation;
     return l;
 }
 
-// Run a model on input X
+// Rows [row, row + rows) of a matrix, sharing its row pointers.
+static matrix row_slice(matrix m, int row, int rows)
+{
+    matrix s = m;
+    s.shallow = 1;
+    s.rows = rows;
+    s.data = m.data + row;
+    if(m.vals) s.vals = m.vals + (size_t)row*m.stride;
+    return s;
+}
+
+// Run a model on input X for training, keeping what backward_model needs
+// in the layers.
 // model m: model to run
 // matrix X: input to model
-// returns: result matrix
-matrix forward_model(model m, matrix X)
+// returns: result matrix, owned by the last layer
+static matrix forward_train(model m, matrix X)
 {
     int i;
     for(i = 0; i < m.n; ++i){
@@ -139,19 +256,51 @@ matrix forward_model(model m, matrix X)
     return X;
 }
 
+// Run a model on input X
+// Rows go through the layers PREDICT_ROWS at a time in two scratch
+// matrices, so inference on a whole dataset neither grows the layers'
+// training workspaces nor holds the activations of every row at once.
+// model m: model to run
+// matrix X: input to model
+// returns: result matrix, free with free_matrix
+matrix forward_model(model m, matrix X)
+{
+    int i, r, widest = 1;
+    for(i = 0; i < m.n; ++i) widest = MAX(widest, m.layers[i].w.cols);
+    matrix p = make_matrix(X.rows, m.n ? m.layers[m.n-1].w.cols : X.cols);
+    matrix buf[2] = {make_matrix(PREDICT_ROWS, widest), make_matrix(PREDICT_ROWS, widest)};
+    for(r = 0; r < X.rows; r += PREDICT_ROWS){
+        int rows = MIN(PREDICT_ROWS, X.rows - r);
+        matrix in = row_slice(X, r, rows);
+        if(m.n == 0){
+            for(i = 0; i < rows; ++i) memcpy(p.data[r+i], in.data[i], X.cols*sizeof(double));
+        }
+        for(i = 0; i < m.n; ++i){
+            layer *l = m.layers + i;
+            matrix out = i == m.n-1 ? row_slice(p, r, rows) : buf[i % 2];
+            out.rows = rows;
+            out.cols = l->w.cols;
+            gemm_hooks hooks = {0, activate_hook, &l->activation};
+            gemm_fused(0, 0, 1, in, l->w, 0, out, hooks);
+            in = out;
+        }
+    }
+    free_matrix(buf[0]);
+    free_matrix(buf[1]);
+    return p;
+}
+
 // Run a model backward given gradient dL
 // model m: model to run
-// matrix dL: partial derivative of loss w.r.t. model output dL/dy
+// matrix dL: partial derivative of loss w.r.t. model output dL/dy,
+//            used as scratch space and overwritten
 void backward_model(model m, matrix dL)
 {
-    matrix d = copy_matrix(dL);
+    matrix d = dL;
     int i;
     for(i = m.n-1; i >= 0; --i){
-        matrix prev = backward_layer(m.layers + i, d);
-        free_matrix(d);
-        d = prev;
+        d = backward_layer(m.layers + i, d);
     }
-    free_matrix(d);
 }
 
 // Update the model weights
@@ -198,6 +347,7 @@ double accuracy_model(model m, data d)
     for(i = 0; i < d.y.rows; ++i){
         if(max_index(d.y.data[i], d.y.cols) == max_index(p.data[i], p.cols)) ++correct;
     }
+    free_matrix(p);
     return (double)correct / d.y.rows;
 }
 
@@ -218,6 +368,72 @@ double cross_entropy_loss(matrix y, matrix p)
 }
 
 
+// One step of data-parallel SGD. Every worker runs its own replica of the
+// model on a fixed slice of the batch, then the weight gradients are summed
+// pairwise in a fixed order, so results only depend on the seed and the
+// number of threads.
+typedef struct{
+    model *replicas;        // replicas[0] is the model itself
+    int threads;
+    data b;                 // Current batch
+    matrix dL;              // dL/dy for the whole batch
+    double *loss;           // Summed loss of each slice
+    int stop;               // Workers exit at the next start barrier
+    pthread_barrier_t start, step;
+} trainer;
+
+typedef struct{
+    trainer *tr;
+    int t;
+} train_job;
+
+// Forward and backward pass of worker t over its slice of the batch,
+// followed by its share of the tree reduction of dw into replica 0.
+static void train_slice(trainer *tr, int t)
+{
+    int T = tr->threads, batch = tr->b.X.rows;
+    int r0 = (int)((long)t*batch/T), rows = (int)((long)(t+1)*batch/T) - r0;
+    model m = tr->replicas[t];
+    matrix y = row_slice(tr->b.y, r0, rows);
+    matrix dL = row_slice(tr->dL, r0, rows);
+    matrix p = forward_train(m, row_slice(tr->b.X, r0, rows));
+    tr->loss[t] = cross_entropy_loss(y, p)*rows;
+    int i, j, k, s;
+    // partial derivative of loss dL/dy
+    for(i = 0; i < rows; ++i){
+        for(j = 0; j < dL.cols; ++j) dL.data[i][j] = y.data[i][j] - p.data[i][j];
+    }
+    backward_model(m, dL);
+
+    for(s = 1; s < T; s *= 2){
+        pthread_barrier_wait(&tr->step);
+        if(t % (2*s) || t + s >= T) continue;
+        for(k = 0; k < m.n; ++k){
+            matrix dw = m.layers[k].dw;
+            matrix other = tr->replicas[t + s].layers[k].dw;
+            for(i = 0; i < dw.rows; ++i){
+                for(j = 0; j < dw.cols; ++j) dw.data[i][j] += other.data[i][j];
+            }
+        }
+    }
+}
+
+static void *train_worker(void *ptr)
+{
+    train_job *job = ptr;
+    trainer *tr = job->tr;
+#ifdef _OPENMP
+    // The workers already fill the cores, keep gemm on this thread.
+    omp_set_num_threads(1);
+#endif
+    for(;;){
+        pthread_barrier_wait(&tr->start);
+        if(tr->stop) break;
+        train_slice(tr, job->t);
+    }
+    return 0;
+}
+
 // Train a model on a dataset using SGD
 // model m: model to train
 // data d: dataset to train on
@@ -226,17 +442,79 @@ double cross_entropy_loss(matrix y, matrix p)
 // double rate: learning rate
 // double momentum: momentum
 // double decay: weight decay
+// With m.threads above 1 the batch is split across that many workers, each
+// with a replica of the layers that shares the weights. The batch, dL and
+// the replicas are allocated once, so after the first iteration nothing is.
 void train_model(model m, data d, int batch, int iters, double rate, double momentum, double decay)
 {
-    int e;
+    int T = m.threads > 1 ? m.threads : 1;
+    if(T > batch) T = batch;
+    trainer tr = {0};
+    tr.threads = T;
+    tr.b = random_batch(d, batch);
+    tr.dL = make_matrix(batch, d.y.cols);
+    tr.loss = calloc(T, sizeof(double));
+    tr.replicas = calloc(T, sizeof(model));
+    tr.replicas[0] = m;
+    int e, t, k;
+    for(t = 1; t < T; ++t){
+        model r = {calloc(m.n, sizeof(layer)), m.n, 1};
+        for(k = 0; k < m.n; ++k){
+            layer l = m.layers[k];
+            l.out = make_matrix(0, l.w.cols);
+            l.dx = make_matrix(0, l.w.rows);
+            l.dw = make_matrix(l.w.rows, l.w.cols);
+            l.batch = 0;
+            l.dx_batch = 0;
+            r.layers[k] = l;
+        }
+        tr.replicas[t] = r;
+    }
+    pthread_t *workers = calloc(T, sizeof(pthread_t));
+    train_job *jobs = calloc(T, sizeof(train_job));
+#ifdef _OPENMP
+    int omp_threads = omp_get_max_threads();
+    if(T > 1) omp_set_num_threads(1);
+#endif
+    pthread_barrier_init(&tr.start, 0, T);
+    pthread_barrier_init(&tr.step, 0, T);
+    for(t = 1; t < T; ++t){
+        jobs[t].tr = &tr;
+        jobs[t].t = t;
+        pthread_create(workers + t, 0, train_worker, jobs + t);
+    }
+
     for(e = 0; e < iters; ++e){
-        data b = random_batch(d, batch);
-        matrix p = forward_model(m, b.X);
-        fprintf(stderr, "%06d: Loss: %f\n", e, cross_entropy_loss(b.y, p));
-        matrix dL = axpy_matrix(-1, p, b.y); // partial derivative of loss dL/dy
-        backward_model(m, dL);
+        if(e) resample_batch(d, tr.b);
+        if(T > 1) pthread_barrier_wait(&tr.start);
+        train_slice(&tr, 0);
+        double loss = 0;
+        for(t = 0; t < T; ++t) loss += tr.loss[t];
+        fprintf(stderr, "%06d: Loss: %f\n", e, loss/batch);
         update_model(m, rate/batch, momentum, decay);
-        free_matrix(dL);
-        free_data(b);
     }
+
+    tr.stop = 1;
+    if(T > 1) pthread_barrier_wait(&tr.start);
+    for(t = 1; t < T; ++t){
+        pthread_join(workers[t], 0);
+        for(k = 0; k < m.n; ++k){
+            layer l = tr.replicas[t].layers[k];
+            free_matrix(l.out);
+            free_matrix(l.dx);
+            free_matrix(l.dw);
+        }
+        free(tr.replicas[t].layers);
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads);
+#endif
+    pthread_barrier_destroy(&tr.start);
+    pthread_barrier_destroy(&tr.step);
+    free(workers);
+    free(jobs);
+    free(tr.replicas);
+    free(tr.loss);
+    free_matrix(tr.dL);
+    free_data(tr.b);
 }
@@ -1,29 +1,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 #include "image.h"
 #include "list.h"
+#include "stb_image.h"
+
+#define CACHE_MAGIC "UWDS"
+#define CACHE_VERSION 2
+
+// Header of a packed dataset cache. It is followed by n images of
+// w*h*c bytes each, channel planes in the same order as image.data,
+// then n label masks of (k + 7) / 8 bytes, bit i % 8 of byte i / 8 set
+// for every label i that matches the image, as in the rows of y.
+typedef struct{
+    char magic[4];
+    int version;
+    int n;
+    int w, h, c;
+    int k;
+} cache_header;
+
+// Point the rows of an existing batch at new random rows of d.
+// data d: dataset to sample from.
+// data b: batch from random_batch, its row pointers are overwritten.
+void resample_batch(data d, data b)
+{
+    int i;
+    for(i = 0; i < b.X.rows; ++i){
+        int ind = rand()%d.X.rows;
+        b.X.data[i] = d.X.data[ind];
+        b.y.data[i] = d.y.data[ind];
+    }
+}
 
 data random_batch(data d, int n)
 {
     matrix X = {0};
     matrix y = {0};
+    // Rows are gathered from d, so there is no single stride.
     X.shallow = y.shallow = 1;
     X.rows = y.rows = n;
     X.cols = d.X.cols;
     y.cols = d.y.cols;
     X.data = calloc(n, sizeof(double*));
     y.data = calloc(n, sizeof(double*));
-    int i;
-    for(i = 0; i < n; ++i){
-        int ind = rand()%d.X.rows;
-        X.data[i] = d.X.data[ind];
-        y.data[i] = d.y.data[ind];
-    }
     data c;
     c.X = X;
     c.y = y;
+    resample_batch(d, c);
     return c;
 }
 
@@ -43,48 +76,366 @@ list *get_lines(char *filename)
     return lines;
 }
 
-data load_classification_data(char *images, char *label_file, int bias)
+// Open addressing hash table from label string to label index.
+// Paths are split into alphanumeric tokens that are looked up whole,
+// labels that never show up as a whole token fall back to strstr.
+typedef struct{
+    int size;
+    char **keys;
+    int *vals;
+    char **labels;
+    int k;
+} label_table;
+
+static unsigned int hash_string(const char *s)
+{
+    unsigned int h = 5381;
+    while(*s) h = h*33 + (unsigned char)*s++;
+    return h;
+}
+
+static label_table make_label_table(char **labels, int k)
+{
+    label_table t;
+    t.size = 16;
+    while(t.size < 2*k) t.size *= 2;
+    t.keys = calloc(t.size, sizeof(char *));
+    t.vals = calloc(t.size, sizeof(int));
+    t.labels = labels;
+    t.k = k;
+    int i;
+    for(i = 0; i < k; ++i){
+        unsigned int h = hash_string(labels[i]) & (t.size - 1);
+        while(t.keys[h] && strcmp(t.keys[h], labels[i])) h = (h + 1) & (t.size - 1);
+        if(!t.keys[h]){
+            t.keys[h] = labels[i];
+            t.vals[h] = i;
+        }
+    }
+    return t;
+}
+
+static void free_label_table(label_table t)
+{
+    free(t.keys);
+    free(t.vals);
+}
+
+// Find the labels that appear in a path.
+// label_table t: labels to look for.
+// char *path: image path.
+// double *y: if not null, set to 1 at every matching label.
+// returns: smallest matching label index, or -1 if no label matches.
+static int match_labels(label_table t, char *path, double *y)
+{
+    char token[256];
+    int first = -1;
+    char *p = path;
+    while(*p){
+        int len = 0;
+        while(*p && !isalnum((unsigned char)*p)) ++p;
+        while(*p && isalnum((unsigned char)*p)){
+            if(len < 255) token[len++] = *p;
+            ++p;
+        }
+        if(!len) continue;
+        token[len] = 0;
+        unsigned int h = hash_string(token) & (t.size - 1);
+        while(t.keys[h]){
+            if(!strcmp(t.keys[h], token)){
+                int i = t.vals[h];
+                if(y) y[i] = 1;
+                if(first < 0 || i < first) first = i;
+                break;
+            }
+            h = (h + 1) & (t.size - 1);
+        }
+    }
+    if(first < 0){
+        int i;
+        for(i = 0; i < t.k; ++i){
+            if(strstr(path, t.labels[i])){
+                if(y) y[i] = 1;
+                if(first < 0) first = i;
+            }
+        }
+    }
+    return first;
+}
+
+// Decode every image in a list once and write a packed dataset cache,
+// named after the image list with ".bin" appended.
+// char *images: file listing one image path per line.
+// char *label_file: file listing one label per line.
+void save_classification_cache(char *images, char *label_file)
 {
     list *image_list = get_lines(images);
     list *label_list = get_lines(label_file);
-    int k = label_list->size;
     char **labels = (char **)list_to_array(label_list);
+    label_table table = make_label_table(labels, label_list->size);
+    char buff[1024];
+    sprintf(buff, "%s.bin", images);
+    FILE *fp = fopen(buff, "wb");
+    if(!fp) {
+        fprintf(stderr, "Couldn't open file %s\n", buff);
+        exit(0);
+    }
+    cache_header head = {{0}};
+    memcpy(head.magic, CACHE_MAGIC, 4);
+    head.version = CACHE_VERSION;
+    head.n = image_list->size;
+    head.k = label_list->size;
+    fwrite(&head, sizeof(head), 1, fp);
 
-    int n = image_list->size;
-    node *nd = image_list->front;
-    int cols = 0;
-    int i;
+    int mask_bytes = (head.k + 7) / 8;
+    unsigned char *masks = calloc((size_t)head.n*mask_bytes + 1, 1);
+    double *match = calloc(head.k + 1, sizeof(double));
+    unsigned char *pixels = 0;
     int count = 0;
-    matrix X;
-    matrix y = make_matrix(n, k);
-    while(nd){
+    node *nd;
+    for(nd = image_list->front; nd; nd = nd->next, ++count){
         char *path = (char *)nd->val;
         image im = load_image(path);
-        if (!cols) {
-            cols = im.w*im.h*im.c;
-            X = make_matrix(n, cols + (bias != 0));
+        int size = im.w*im.h*im.c, i;
+        if(!pixels){
+            head.w = im.w; head.h = im.h; head.c = im.c;
+            pixels = calloc(size, 1);
+        }
+        if(im.w != head.w || im.h != head.h || im.c != head.c){
+            fprintf(stderr, "Image %s is not %dx%dx%d\n", path, head.w, head.h, head.c);
+            exit(0);
         }
-        for (i = 0; i < cols; ++i){
-            X.data[count][i] = im.data[i];
+        for(i = 0; i < size; ++i) pixels[i] = (unsigned char)roundf(255*im.data[i]);
+        fwrite(pixels, 1, size, fp);
+        memset(match, 0, head.k*sizeof(double));
+        match_labels(table, path, match);
+        for(i = 0; i < head.k; ++i){
+            if(match[i]) masks[(size_t)count*mask_bytes + i/8] |= 1 << (i%8);
         }
-        if(bias) X.data[count][cols] = 1;
+        free_image(im);
+    }
+    fwrite(masks, 1, (size_t)head.n*mask_bytes, fp);
+    rewind(fp);
+    fwrite(&head, sizeof(head), 1, fp);
+    fclose(fp);
+    fprintf(stderr, "Wrote %d images to %s\n", head.n, buff);
 
-        for (i = 0; i < k; ++i){
-            if(strstr(path, labels[i])){
-                y.data[count][i] = 1;
+    free(pixels);
+    free(masks);
+    free(match);
+    free_label_table(table);
+    free(labels);
+    free_list_contents(label_list);
+    free_list(label_list);
+    free_list_contents(image_list);
+    free_list(image_list);
+}
+
+// Load a dataset from a packed cache by memory-mapping it.
+// char *filename: cache written by save_classification_cache.
+// int k: number of labels expected.
+// int bias: add a constant 1 column to X.
+// data *d: filled in on success.
+// returns: 1 on success, 0 if the file is missing or doesn't match.
+int load_classification_cache(char *filename, int k, int bias, data *d)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat st;
+    fstat(fd, &st);
+    if(st.st_size < (off_t)sizeof(cache_header)){
+        close(fd);
+        return 0;
+    }
+    unsigned char *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+
+    cache_header head;
+    memcpy(&head, map, sizeof(head));
+    size_t size = (size_t)head.w*head.h*head.c;
+    size_t mask_bytes = (k + 7) / 8;
+    if(memcmp(head.magic, CACHE_MAGIC, 4) || head.version != CACHE_VERSION || head.k != k ||
+       (off_t)(sizeof(head) + head.n*size + head.n*mask_bytes) != st.st_size){
+        fprintf(stderr, "Ignoring stale dataset cache %s\n", filename);
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    // Same float rounding load_image does, so X is identical either way.
+    double lut[256];
+    int i, j;
+    for(i = 0; i < 256; ++i) lut[i] = (float)(i/255.);
+
+    const unsigned char *pixels = map + sizeof(head);
+    matrix X = make_matrix(head.n, size + (bias != 0));
+    matrix y = make_matrix(head.n, k);
+    for(i = 0; i < head.n; ++i){
+        const unsigned char *src = pixels + i*size;
+        double *row = X.data[i];
+        for(j = 0; j < size; ++j) row[j] = lut[src[j]];
+        if(bias) row[size] = 1;
+    }
+    const unsigned char *masks = pixels + head.n*size;
+    for(i = 0; i < head.n; ++i){
+        const unsigned char *mask = masks + i*mask_bytes;
+        for(j = 0; j < k; ++j) y.data[i][j] = (mask[j/8] >> (j%8)) & 1;
+    }
+    munmap(map, st.st_size);
+    d->X = X;
+    d->y = y;
+    return 1;
+}
+
+// Shared state of the decoding workers.
+// int next: next path to claim.
+// int done: paths finished, for progress reports.
+typedef struct{
+    char **paths;
+    int n;
+    int cols;
+    matrix X;
+    int next;
+    int done;
+} ingest_job;
+
+// Decode one image straight into a row of X, in image.data layout.
+static void decode_into_row(char *path, double *row, int cols)
+{
+    int w, h, c, i, k;
+    unsigned char *pixels = stbi_load(path, &w, &h, &c, 0);
+    if(!pixels){
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", path, stbi_failure_reason());
+        return;
+    }
+    int keep = c == 4 ? 3 : c;
+    if(w*h*keep != cols){
+        fprintf(stderr, "Image %s is not the same size as the first image\n", path);
+    } else {
+        for(k = 0; k < keep; ++k){
+            for(i = 0; i < w*h; ++i){
+                row[k*w*h + i] = (float)(pixels[i*c + k]/255.);
             }
         }
-        ++count;
-        nd = nd->next;
     }
+    stbi_image_free(pixels);
+}
+
+static void *ingest_worker(void *ptr)
+{
+    ingest_job *job = (ingest_job *)ptr;
+    int i;
+    while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n){
+        decode_into_row(job->paths[i], job->X.data[i], job->cols);
+        __atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static double wall_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Decode a list of images into the rows of X with one worker per core.
+// Workers claim paths by index, so each row is written by exactly one
+// thread and no locking is needed. Progress goes to stderr.
+// char **paths: image paths.
+// int n: number of paths.
+// matrix X: n rows with at least cols columns, already allocated.
+// int cols: pixels per image.
+void ingest_images(char **paths, int n, matrix X, int cols)
+{
+    ingest_job job = {paths, n, cols, X, 0, 0};
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads < 1) threads = 1;
+    if(threads > n) threads = n;
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    int i;
+    double start = wall_time();
+    for(i = 0; i < threads; ++i){
+        pthread_create(workers + i, 0, ingest_worker, &job);
+    }
+    int done;
+    double report = start;
+    while((done = __atomic_load_n(&job.done, __ATOMIC_ACQUIRE)) < n){
+        struct timespec pause = {0, 10000000};
+        nanosleep(&pause, 0);
+        double now = wall_time();
+        if(now - report > .5){
+            report = now;
+            fprintf(stderr, "\rLoaded %d/%d images, %.0f images/s", done, n, done/(now - start));
+        }
+    }
+    for(i = 0; i < threads; ++i){
+        pthread_join(workers[i], 0);
+    }
+    double elapsed = wall_time() - start;
+    fprintf(stderr, "\rLoaded %d images in %.2fs with %d threads, %.0f images/s\n", n, elapsed, threads, elapsed > 0 ? n/elapsed : 0);
+    free(workers);
+}
+
+// Load a labeled image dataset. Uses the packed cache "<images>.bin" when
+// one exists and is newer than the image list, otherwise decodes every
+// image in the list.
+// char *images: file listing one image path per line.
+// char *label_file: file listing one label per line.
+// int bias: add a constant 1 column to X.
+data load_classification_data(char *images, char *label_file, int bias)
+{
+    char buff[1024];
+    struct stat list_st, cache_st;
+    sprintf(buff, "%s.bin", images);
+    if(!stat(buff, &cache_st) && !stat(images, &list_st) && cache_st.st_mtime >= list_st.st_mtime){
+        list *label_list = get_lines(label_file);
+        int k = label_list->size;
+        free_list_contents(label_list);
+        free_list(label_list);
+        data d;
+        if(load_classification_cache(buff, k, bias, &d)) return d;
+    }
+
+    list *image_list = get_lines(images);
+    list *label_list = get_lines(label_file);
+    int k = label_list->size;
+    char **labels = (char **)list_to_array(label_list);
+    char **paths = (char **)list_to_array(image_list);
+    int n = image_list->size;
+
+    int w = 0, h = 0, c = 0, i;
+    if(n && !stbi_info(paths[0], &w, &h, &c)){
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", paths[0], stbi_failure_reason());
+        exit(0);
+    }
+    //We don't like alpha channels, #YOLO
+    if(c == 4) c = 3;
+    int cols = w*h*c;
+    matrix X = make_matrix(n, cols + (bias != 0));
+    matrix y = make_matrix(n, k);
+
+    ingest_images(paths, n, X, cols);
+
+    label_table table = make_label_table(labels, k);
+    for(i = 0; i < n; ++i){
+        if(bias) X.data[i][cols] = 1;
+        match_labels(table, paths[i], y.data[i]);
+    }
+    free_label_table(table);
+
+    free(paths);
+    free(labels);
+    free_list_contents(image_list);
     free_list(image_list);
+    free_list_contents(label_list);
+    free_list(label_list);
     data d;
     d.X = X;
     d.y = y;
     return d;
 }
 
-
 char *fgetl(FILE *fp)
 {
     if(feof(fp)) return 0;
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "gemm.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Products smaller than this many multiply-adds skip packing entirely.
+#define GEMM_SMALL 32768
+
+// Packing buffers only ever grow, one pair per calling thread, so steady
+// state multiplies do not touch the allocator. They are freed by a
+// thread-specific key's destructor when the thread exits.
+typedef struct{
+    double *a, *b;
+    size_t a_size, b_size;
+} pack_buffers;
+
+static pthread_key_t pack_key;
+static pthread_once_t pack_once = PTHREAD_ONCE_INIT;
+
+static void free_pack_buffers(void *p)
+{
+    pack_buffers *pb = p;
+    free(pb->a);
+    free(pb->b);
+    free(pb);
+}
+
+static void make_pack_key()
+{
+    pthread_key_create(&pack_key, free_pack_buffers);
+}
+
+// The packing buffers of the calling thread.
+static pack_buffers *thread_buffers()
+{
+    pthread_once(&pack_once, make_pack_key);
+    pack_buffers *pb = pthread_getspecific(pack_key);
+    if(!pb){
+        pb = calloc(1, sizeof(pack_buffers));
+        pthread_setspecific(pack_key, pb);
+    }
+    return pb;
+}
+
+static double *grow_buffer(double **buf, size_t *size, size_t n)
+{
+    if(*size < n){
+        free(*buf);
+        *buf = aligned_alloc(64, (n*sizeof(double) + 63) / 64 * 64);
+        *size = n;
+    }
+    return *buf;
+}
+
+// Pack an mc x kc block of op(A) into MR-row panels, k-major inside a panel.
+// Rows past mc are zero so the kernel never needs an edge case.
+static void pack_a(matrix a, int TA, int i0, int mc, int k0, int kc, double *dst)
+{
+    int ir, r, p;
+    for(ir = 0; ir < mc; ir += GEMM_MR, dst += GEMM_MR*kc){
+        int mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+        if(!TA){
+            for(r = 0; r < mr; ++r){
+                const double *row = a.data[i0 + ir + r] + k0;
+                for(p = 0; p < kc; ++p) dst[p*GEMM_MR + r] = row[p];
+            }
+        } else {
+            for(p = 0; p < kc; ++p){
+                const double *row = a.data[k0 + p] + i0 + ir;
+                for(r = 0; r < mr; ++r) dst[p*GEMM_MR + r] = row[r];
+            }
+        }
+        for(r = mr; r < GEMM_MR; ++r){
+            for(p = 0; p < kc; ++p) dst[p*GEMM_MR + r] = 0;
+        }
+    }
+}
+
+// Pack a kc x nc block of op(B) into NR-column panels, k-major inside a panel.
+static void pack_b(matrix b, int TB, int k0, int kc, int j0, int nc, double *dst)
+{
+    int jr, c, p;
+    for(jr = 0; jr < nc; jr += GEMM_NR, dst += GEMM_NR*kc){
+        int nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+        if(!TB){
+            for(p = 0; p < kc; ++p){
+                const double *row = b.data[k0 + p] + j0 + jr;
+                for(c = 0; c < nr; ++c) dst[p*GEMM_NR + c] = row[c];
+                for(; c < GEMM_NR; ++c) dst[p*GEMM_NR + c] = 0;
+            }
+        } else {
+            for(c = 0; c < nr; ++c){
+                const double *row = b.data[j0 + jr + c] + k0;
+                for(p = 0; p < kc; ++p) dst[p*GEMM_NR + c] = row[p];
+            }
+            for(; c < GEMM_NR; ++c){
+                for(p = 0; p < kc; ++p) dst[p*GEMM_NR + c] = 0;
+            }
+        }
+    }
+}
+
+// Multiply one packed MR x kc panel of A by one kc x NR panel of B.
+// double *ab: MR x NR result, row-major.
+#if defined(__AVX512F__)
+static void micro_kernel(int kc, const double *A, const double *B, double *ab)
+{
+    __m512d c[GEMM_MR][2];
+    int r, p;
+    for(r = 0; r < GEMM_MR; ++r) c[r][0] = c[r][1] = _mm512_setzero_pd();
+    for(p = 0; p < kc; ++p, A += GEMM_MR, B += GEMM_NR){
+        __m512d b0 = _mm512_load_pd(B);
+        __m512d b1 = _mm512_load_pd(B + 8);
+        #pragma GCC unroll 8
+        for(r = 0; r < GEMM_MR; ++r){
+            __m512d a = _mm512_set1_pd(A[r]);
+            c[r][0] = _mm512_fmadd_pd(a, b0, c[r][0]);
+            c[r][1] = _mm512_fmadd_pd(a, b1, c[r][1]);
+        }
+    }
+    for(r = 0; r < GEMM_MR; ++r){
+        _mm512_storeu_pd(ab + r*GEMM_NR, c[r][0]);
+        _mm512_storeu_pd(ab + r*GEMM_NR + 8, c[r][1]);
+    }
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+static void micro_kernel(int kc, const double *A, const double *B, double *ab)
+{
+    __m256d c[GEMM_MR][2];
+    int r, p;
+    for(r = 0; r < GEMM_MR; ++r) c[r][0] = c[r][1] = _mm256_setzero_pd();
+    for(p = 0; p < kc; ++p, A += GEMM_MR, B += GEMM_NR){
+        __m256d b0 = _mm256_load_pd(B);
+        __m256d b1 = _mm256_load_pd(B + 4);
+        #pragma GCC unroll 6
+        for(r = 0; r < GEMM_MR; ++r){
+            __m256d a = _mm256_broadcast_sd(A + r);
+            c[r][0] = _mm256_fmadd_pd(a, b0, c[r][0]);
+            c[r][1] = _mm256_fmadd_pd(a, b1, c[r][1]);
+        }
+    }
+    for(r = 0; r < GEMM_MR; ++r){
+        _mm256_storeu_pd(ab + r*GEMM_NR, c[r][0]);
+        _mm256_storeu_pd(ab + r*GEMM_NR + 4, c[r][1]);
+    }
+}
+#else
+static void micro_kernel(int kc, const double *A, const double *B, double *ab)
+{
+    int r, c, p;
+    for(r = 0; r < GEMM_MR*GEMM_NR; ++r) ab[r] = 0;
+    for(p = 0; p < kc; ++p, A += GEMM_MR, B += GEMM_NR){
+        for(r = 0; r < GEMM_MR; ++r){
+            for(c = 0; c < GEMM_NR; ++c){
+                ab[r*GEMM_NR + c] += A[r]*B[c];
+            }
+        }
+    }
+}
+#endif
+
+// Unpacked i-k-j product for matrices too small to be worth packing.
+static void gemm_small(int TA, int TB, double alpha, matrix a, matrix b, matrix c, int K)
+{
+    int i, j, k;
+    for(i = 0; i < c.rows; ++i){
+        double *crow = c.data[i];
+        for(k = 0; k < K; ++k){
+            double aik = alpha * (TA ? a.data[k][i] : a.data[i][k]);
+            if(!TB){
+                const double *brow = b.data[k];
+                for(j = 0; j < c.cols; ++j) crow[j] += aik*brow[j];
+            } else {
+                for(j = 0; j < c.cols; ++j) crow[j] += aik*b.data[j][k];
+            }
+        }
+    }
+}
+
+// Run the B prologue over rows k0..k0+kc of columns j0..j0+nc.
+static void b_prologue(gemm_hooks hooks, matrix b, int k0, int kc, int j0, int nc)
+{
+    int p;
+    if(!hooks.b_prologue) return;
+    for(p = 0; p < kc; ++p){
+        hooks.b_prologue(b.data[k0 + p] + j0, k0 + p, j0, nc, hooks.ctx);
+    }
+}
+
+// Run the C epilogue over rows i0..i0+mc.
+static void c_epilogue(gemm_hooks hooks, matrix c, int i0, int mc)
+{
+    int i;
+    if(!hooks.c_epilogue) return;
+    for(i = i0; i < i0 + mc; ++i){
+        hooks.c_epilogue(c.data[i], i, c.cols, hooks.ctx);
+    }
+}
+
+// General matrix multiply, C = alpha*op(A)*op(B) + beta*C.
+// int TA, TB: use the transpose of a (b) without forming it.
+// double alpha, beta: scalars.
+// matrix a, b: inputs, op(a) is M x K and op(b) is K x N.
+// matrix c: M x N output, updated in place.
+void gemm(int TA, int TB, double alpha, matrix a, matrix b, double beta, matrix c)
+{
+    gemm_hooks none = {0};
+    gemm_fused(TA, TB, alpha, a, b, beta, c, none);
+}
+
+// gemm with elementwise prologue and epilogue hooks, see gemm_hooks.
+void gemm_fused(int TA, int TB, double alpha, matrix a, matrix b, double beta, matrix c, gemm_hooks hooks)
+{
+    int M = TA ? a.cols : a.rows;
+    int K = TA ? a.rows : a.cols;
+    int N = TB ? b.rows : b.cols;
+    assert(K == (TB ? b.cols : b.rows));
+    assert(c.rows == M && c.cols == N);
+    assert(!hooks.b_prologue || !TB);
+    int i, j;
+    if(beta != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                c.data[i][j] = beta == 0 ? 0 : beta*c.data[i][j];
+            }
+        }
+    }
+    if(M == 0 || N == 0 || K == 0 || alpha == 0){
+        b_prologue(hooks, b, 0, K, 0, N);
+        c_epilogue(hooks, c, 0, M);
+        return;
+    }
+    if((double)M*N*K < GEMM_SMALL){
+        b_prologue(hooks, b, 0, K, 0, N);
+        gemm_small(TA, TB, alpha, a, b, c, K);
+        c_epilogue(hooks, c, 0, M);
+        return;
+    }
+
+    // Rows of C are only complete inside the loop if one block spans N.
+    int late_epilogue = N > GEMM_NC;
+    int jc, pc, ic;
+    pack_buffers *pb = thread_buffers();
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = N - jc < GEMM_NC ? N - jc : GEMM_NC;
+        int ncp = (nc + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = K - pc < GEMM_KC ? K - pc : GEMM_KC;
+            int last = pc + kc == K && !late_epilogue;
+            double *bp = grow_buffer(&pb->b, &pb->b_size, (size_t)ncp*kc);
+            b_prologue(hooks, b, pc, kc, jc, nc);
+            pack_b(b, TB, pc, kc, jc, nc, bp);
+
+            #pragma omp parallel for schedule(dynamic)
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = M - ic < GEMM_MC ? M - ic : GEMM_MC;
+                pack_buffers *own = thread_buffers();
+                double *ap = grow_buffer(&own->a, &own->a_size, (size_t)GEMM_MC*GEMM_KC);
+                double ab[GEMM_MR*GEMM_NR];
+                int ir, jr, r, s;
+                pack_a(a, TA, ic, mc, pc, kc, ap);
+                for(jr = 0; jr < nc; jr += GEMM_NR){
+                    int nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+                    for(ir = 0; ir < mc; ir += GEMM_MR){
+                        int mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+                        micro_kernel(kc, ap + ir*kc, bp + jr*kc, ab);
+                        for(r = 0; r < mr; ++r){
+                            double *crow = c.data[ic + ir + r] + jc + jr;
+                            for(s = 0; s < nr; ++s) crow[s] += alpha*ab[r*GEMM_NR + s];
+                        }
+                    }
+                }
+                // This block of C is finished and still in cache.
+                if(last) c_epilogue(hooks, c, ic, mc);
+            }
+        }
+    }
+    if(late_epilogue) c_epilogue(hooks, c, 0, M);
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static void naive_mult(matrix a, matrix b, matrix p)
+{
+    int i, j, k;
+    for(i = 0; i < p.rows; ++i){
+        for(j = 0; j < p.cols; ++j){
+            double sum = 0;
+            for(k = 0; k < a.cols; ++k){
+                sum += a.data[i][k]*b.data[k][j];
+            }
+            p.data[i][j] = sum;
+        }
+    }
+}
+
+// Print GFLOP/s of square multiplies for sizes 32, 64, ... up to max,
+// against the old i-j-k loop for sizes where it finishes reasonably.
+// int max: largest matrix size.
+void gemm_benchmark(int max)
+{
+    int n;
+    printf("%6s %12s %12s %12s %12s\n", "n", "naive", "NN", "NT", "TN");
+    for(n = 32; n <= max; n *= 2){
+        matrix a = random_matrix(n, n, 1);
+        matrix b = random_matrix(n, n, 1);
+        matrix c = make_matrix(n, n);
+        double flops = 2.0*n*n*n;
+        double gflops[4] = {0};
+        int v;
+        for(v = 0; v < 4; ++v){
+            if(v == 0 && n > 1024) continue;
+            int reps = 0;
+            double start = now(), elapsed;
+            do {
+                if(v == 0) naive_mult(a, b, c);
+                else gemm(v == 3, v == 2, 1, a, b, 0, c);
+                ++reps;
+                elapsed = now() - start;
+            } while(elapsed < .2);
+            gflops[v] = flops*reps/elapsed*1e-9;
+        }
+        printf("%6d %12.2f %12.2f %12.2f %12.2f\n", n, gflops[0], gflops[1], gflops[2], gflops[3]);
+        free_matrix(a);
+        free_matrix(b);
+        free_matrix(c);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef GEMM_H
+#define GEMM_H
+#include "matrix.h"
+
+// Register block of the micro-kernel and cache block sizes, in doubles.
+// MC x KC of A stays in L2, KC x NR of B streams through L1.
+#if defined(__AVX512F__)
+#define GEMM_MR 8
+#define GEMM_NR 16
+#elif defined(__AVX2__) && defined(__FMA__)
+#define GEMM_MR 6
+#define GEMM_NR 8
+#else
+#define GEMM_MR 4
+#define GEMM_NR 4
+#endif
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+// Elementwise work folded into a gemm so it runs while data is in cache.
+// b_prologue: applied in place to the row segment b.data[row][col..col+n)
+//             just before it is packed, each element of B exactly once.
+//             Only used when B is not transposed.
+// c_epilogue: applied to each finished row c.data[row] of all n columns.
+// void *ctx: passed through to both.
+// Either hook may be null. Both may run on several threads at once.
+typedef struct{
+    void (*b_prologue)(double *b, int row, int col, int n, void *ctx);
+    void (*c_epilogue)(double *c, int row, int n, void *ctx);
+    void *ctx;
+} gemm_hooks;
+
+void gemm(int TA, int TB, double alpha, matrix a, matrix b, double beta, matrix c);
+void gemm_fused(int TA, int TB, double alpha, matrix a, matrix b, double beta, matrix c, gemm_hooks hooks);
+void gemm_benchmark(int max);
+
+#endif
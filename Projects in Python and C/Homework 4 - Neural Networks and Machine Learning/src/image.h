@@ -24,10 +24,17 @@ typedef struct{
 // A descriptor for a point in an image.
 // point p: x,y coordinates of the image pixel.
 // int n: the number of floating point values in the descriptor.
+// unsigned char kind: what the values are, a DESCRIPTOR from
+//                     descriptor_set.h. 0 is the patch describe_index makes.
+// unsigned char shared: 0 if data is allocated on its own. Otherwise data
+//                       points into the allocation of a descriptor_set's
+//                       view, which starts at the descriptor marked 1 and
+//                       goes on with ones marked 2.
 // float *data: the descriptor for the pixel.
 typedef struct{
     point p;
     int n;
+    unsigned char kind, shared;
     float *data;
 } descriptor;
 
@@ -130,6 +137,9 @@ typedef struct {
     matrix v;               // Past weight updates (for use with momentum)
     matrix out;             // Saved output from the layer
     ACTIVATION activation;  // Activation the layer uses
+    matrix dx;              // Partial derivative of loss w.r.t. the input
+    int batch;              // Rows out has room for
+    int dx_batch;           // Rows dx has room for
 } layer;
 
 typedef struct{
@@ -140,12 +150,25 @@ typedef struct{
 typedef struct {
     layer *layers;
     int n;
+    int threads;            // Workers used by train_model, 0 or 1 for one
 } model;
 
 data load_classification_data(char *images, char *label_file, int bias);
+void save_classification_cache(char *images, char *label_file);
+void ingest_images(char **paths, int n, matrix X, int cols);
+int load_classification_cache(char *filename, int k, int bias, data *d);
 void free_data(data d);
 data random_batch(data d, int n);
+void resample_batch(data d, data b);
 char *fgetl(FILE *fp);
+void activate_matrix(matrix m, ACTIVATION a);
+void gradient_matrix(matrix m, ACTIVATION a, matrix d);
+layer make_layer(int input, int output, ACTIVATION activation);
+matrix forward_layer(layer *l, matrix in);
+matrix backward_layer(layer *l, matrix delta);
+matrix forward_model(model m, matrix X);
+double accuracy_model(model m, data d);
+void train_model(model m, data d, int batch, int iters, double rate, double momentum, double decay);
 
 #endif
 
@@ -3,6 +3,7 @@
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "gemm.h"
 
 int main(int argc, char **argv)
 {
@@ -10,7 +11,7 @@ int main(int argc, char **argv)
     char *out = find_char_arg(argc, argv, "-o", "out");
     //float scale = find_float_arg(argc, argv, "-s", 1);
     if(argc < 2){
-        printf("usage: %s [test | grayscale]\n", argv[0]);  
+        printf("usage: %s [test | grayscale | gemm | cache]\n", argv[0]);  
     } else if (0 == strcmp(argv[1], "test")){
         run_tests();
     } else if (0 == strcmp(argv[1], "grayscale")){
@@ -19,6 +20,11 @@ int main(int argc, char **argv)
         save_image(g, out);
         free_image(im);
         free_image(g);
+    } else if (0 == strcmp(argv[1], "gemm")){
+        gemm_benchmark(find_int_arg(argc, argv, "-n", 1024));
+    } else if (0 == strcmp(argv[1], "cache")){
+        save_classification_cache(find_char_arg(argc, argv, "-d", "mnist.train"),
+                                  find_char_arg(argc, argv, "-l", "mnist.labels"));
     }
     return 0;
 }
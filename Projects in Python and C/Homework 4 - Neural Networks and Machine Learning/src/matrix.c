@@ -1,4 +1,5 @@
 #include "matrix.h"
+#include "gemm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,33 +25,67 @@ matrix make_translation_homography(float dx, float dy)
 
 void free_matrix(matrix m)
 {
-    if (m.data) {
-        int i;
-        if (!m.shallow) for(i = 0; i < m.rows; ++i) free(m.data[i]);
-        free(m.data);
-    }
+    // Owned matrices are a single block starting with the row pointers,
+    // shallow ones only own their row pointers.
+    free(m.data);
+}
+
+// Number of matrices allocated so far, see matrix_allocations.
+static size_t allocations;
+
+// returns: how many matrices make_matrix and submatrix have allocated.
+size_t matrix_allocations()
+{
+    return allocations;
 }
 
 matrix make_matrix(int rows, int cols)
 {
     matrix m;
+    ++allocations;
     m.rows = rows;
     m.cols = cols;
     m.shallow = 0;
-    m.data = calloc(m.rows, sizeof(double *));
+    m.stride = (cols + 7) / 8 * 8;
+    size_t head = ((size_t)rows*sizeof(double *) + 63) / 64 * 64;
+    size_t body = (size_t)rows*m.stride*sizeof(double);
+    char *block = aligned_alloc(64, head + body ? head + body : 64);
+    memset(block + head, 0, body);
+    m.data = (double **)block;
+    m.vals = (double *)(block + head);
     int i;
-    for(i = 0; i < m.rows; ++i) m.data[i] = calloc(m.cols, sizeof(double));
+    for(i = 0; i < m.rows; ++i) m.data[i] = m.vals + (size_t)i*m.stride;
     return m;
 }
 
+// Make a view of a block of a matrix without copying it.
+// matrix m: matrix to look into, must have contiguous rows.
+// int row, col: position of the top left element of the view in m.
+// int rows, cols: size of the view.
+// returns: shallow matrix sharing m's values, free it with free_matrix.
+matrix submatrix(matrix m, int row, int col, int rows, int cols)
+{
+    assert(m.vals && m.stride);
+    assert(row >= 0 && col >= 0 && row + rows <= m.rows && col + cols <= m.cols);
+    matrix v;
+    ++allocations;
+    v.rows = rows;
+    v.cols = cols;
+    v.shallow = 1;
+    v.stride = m.stride;
+    v.vals = m.vals + (size_t)row*m.stride + col;
+    v.data = calloc(rows ? rows : 1, sizeof(double *));
+    int i;
+    for(i = 0; i < rows; ++i) v.data[i] = v.vals + (size_t)i*v.stride;
+    return v;
+}
+
 matrix copy_matrix(matrix m)
 {
-    int i,j;
+    int i;
     matrix c = make_matrix(m.rows, m.cols);
     for(i = 0; i < m.rows; ++i){
-        for(j = 0; j < m.cols; ++j){
-            c.data[i][j] = m.data[i][j];
-        }
+        memcpy(c.data[i], m.data[i], m.cols*sizeof(double));
     }
     return c;
 }
@@ -83,15 +118,8 @@ matrix make_identity(int rows, int cols)
 matrix matrix_mult_matrix(matrix a, matrix b)
 {
     assert(a.cols == b.rows);
-    int i, j, k;
     matrix p = make_matrix(a.rows, b.cols);
-    for(i = 0; i < p.rows; ++i){
-        for(j = 0; j < p.cols; ++j){
-            for(k = 0; k < a.cols; ++k){
-                p.data[i][j] += a.data[i][k]*b.data[k][j];
-            }
-        }
-    }
+    gemm(0, 0, 1, a, b, 0, p);
     return p;
 }
 
@@ -139,14 +167,9 @@ matrix axpy_matrix(double a, matrix x, matrix y)
 
 matrix transpose_matrix(matrix m)
 {
-    matrix t;
-    t.rows = m.cols;
-    t.cols = m.rows;
-    t.data = calloc(t.rows, sizeof(double *));
-    t.shallow = 0;
+    matrix t = make_matrix(m.cols, m.rows);
     int i, j;
     for(i = 0; i < t.rows; ++i){
-        t.data[i] = calloc(t.cols, sizeof(double));
         for(j = 0; j < t.cols; ++j){
             t.data[i][j] = m.data[j][i];
         }
@@ -219,6 +242,18 @@ double *LUP_solve(matrix L, matrix U, int *p, double *b)
     return c;
 }
 
+// Exchange the contents of two rows, leaving the row pointers in order.
+static void swap_rows(matrix m, int a, int b)
+{
+    int j;
+    if(a == b) return;
+    for(j = 0; j < m.cols; ++j){
+        double swap = m.data[a][j];
+        m.data[a][j] = m.data[b][j];
+        m.data[b][j] = swap;
+    }
+}
+
 matrix matrix_invert(matrix m)
 {
     //print_matrix(m);
@@ -247,9 +282,7 @@ matrix matrix_invert(matrix m)
             return none;
         }
 
-        double *swap = c.data[index];
-        c.data[index] = c.data[k];
-        c.data[k] = swap;
+        swap_rows(c, index, k);
 
         double val = c.data[k][k];
         c.data[k][k] = 1;
@@ -314,9 +347,7 @@ int* in_place_LUP(matrix m)
         pivot[k] = pivot[index];
         pivot[index] = swapi;
 
-        double *swap = m.data[index];
-        m.data[index] = m.data[k];
-        m.data[k] = swap;
+        swap_rows(m, index, k);
 
         for(i = k+1; i < m.rows; ++i){
             m.data[i][k] = m.data[i][k]/m.data[k][k];
@@ -1,9 +1,23 @@
 #ifndef MATRIX_H
 #define MATRIX_H
+#include <stddef.h>
+
+// A dense matrix of doubles.
+// int rows, cols: size of the matrix.
+// double **data: row pointers, data[i][j] is element (i, j).
+// int shallow: the matrix borrows its values from another matrix.
+// int stride: doubles between consecutive rows in vals, 0 if the rows
+//             are gathered from arbitrary places (see random_batch).
+// double *vals: element (0, 0); row i starts at vals + i*stride.
+//
+// Owned matrices keep the row pointers and the values in one 64 byte
+// aligned block, every row starting on a 64 byte boundary.
 typedef struct matrix{
     int rows, cols;
     double **data;
     int shallow;
+    int stride;
+    double *vals;
 } matrix;
 
 typedef struct LUP{
@@ -20,6 +34,8 @@ void free_matrix(matrix m);
 double mag_matrix(matrix m);
 matrix make_matrix(int rows, int cols);
 matrix copy_matrix(matrix m);
+matrix submatrix(matrix m, int row, int col, int rows, int cols);
+size_t matrix_allocations();
 double *sle_solve(matrix A, double *b);
 matrix matrix_mult_matrix(matrix a, matrix b);
 matrix matrix_elmult_matrix(matrix a, matrix b);
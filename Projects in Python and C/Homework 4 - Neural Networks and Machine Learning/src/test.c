@@ -6,6 +6,7 @@
 #include "image.h"
 #include "test.h"
 #include "args.h"
+#include "gemm.h"
 
 void feature_normalize2(image im)
 {
@@ -384,6 +385,272 @@ void test_cornerness()
     free_image(gt);
 }
 
+int same_matrix(matrix a, matrix b)
+{
+    int i, j;
+    if(a.rows != b.rows || a.cols != b.cols) {
+        printf("Expected %d x %d matrix, got %d x %d\n", b.rows, b.cols, a.rows, a.cols);
+        return 0;
+    }
+    for(i = 0; i < a.rows; ++i){
+        for(j = 0; j < a.cols; ++j){
+            if(!within_eps(a.data[i][j], b.data[i][j])){
+                printf("The value should be %f, but it is %f! \n", b.data[i][j], a.data[i][j]);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void test_matrix_storage()
+{
+    matrix m = random_matrix(13, 21, 1);
+    int i;
+    TEST(((size_t)m.vals & 63) == 0 && m.stride % 8 == 0 && m.stride >= m.cols);
+    for(i = 0; i < m.rows; ++i) TEST(m.data[i] == m.vals + i*m.stride);
+
+    matrix v = submatrix(m, 2, 3, 4, 5);
+    TEST(v.shallow && v.rows == 4 && v.cols == 5);
+    v.data[1][2] = 42;
+    TEST(within_eps(m.data[3][5], 42));
+
+    matrix c = copy_matrix(v);
+    TEST(same_matrix(c, v));
+    TEST(!c.shallow && c.data[0] == c.vals);
+
+    matrix id = make_identity_homography();
+    matrix inv = matrix_invert(id);
+    TEST(within_eps(inv.data[2][2], 1) && inv.data[1] == inv.vals + inv.stride);
+    free_matrix(id);
+    free_matrix(inv);
+    free_matrix(c);
+    free_matrix(v);
+    free_matrix(m);
+}
+
+void test_classification_cache()
+{
+    char images[] = "/tmp/uwimg_imagesXXXXXX";
+    char labels[] = "/tmp/uwimg_labelsXXXXXX";
+    char cache[64];
+    FILE *fp = fdopen(mkstemp(images), "w");
+    fprintf(fp, "data/dots.png\ndata/dots.png\n");
+    fclose(fp);
+    fp = fdopen(mkstemp(labels), "w");
+    // The path matches both dots and png.
+    fprintf(fp, "nothing\ndots\npng\n");
+    fclose(fp);
+    sprintf(cache, "%s.bin", images);
+
+    data gt = load_classification_data(images, labels, 1);
+    save_classification_cache(images, labels);
+    data d = {{0}};
+    TEST(load_classification_cache(cache, 3, 1, &d));
+    TEST(same_matrix(d.X, gt.X));
+    TEST(same_matrix(d.y, gt.y));
+    TEST(within_eps(d.y.data[1][1], 1) && within_eps(d.y.data[1][2], 1));
+    TEST(within_eps(d.y.data[1][0], 0));
+    free_data(d);
+
+    d = load_classification_data(images, labels, 1);
+    TEST(same_matrix(d.X, gt.X));
+    free_data(d);
+    free_data(gt);
+    remove(cache);
+    remove(images);
+    remove(labels);
+}
+
+void test_gemm()
+{
+    // Sizes that are not multiples of any block size, big enough to pack.
+    int sizes[2][3] = {{7, 5, 3}, {131, 67, 301}};
+    int s;
+    for(s = 0; s < 2; ++s){
+        int M = sizes[s][0], N = sizes[s][1], K = sizes[s][2];
+        matrix a = random_matrix(M, K, 1);
+        matrix b = random_matrix(K, N, 1);
+        matrix at = transpose_matrix(a);
+        matrix bt = transpose_matrix(b);
+        matrix c = random_matrix(M, N, 1);
+        matrix gt = make_matrix(M, N);
+        int i, j, k;
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                double sum = 0;
+                for(k = 0; k < K; ++k) sum += a.data[i][k]*b.data[k][j];
+                gt.data[i][j] = .5*sum + 2*c.data[i][j];
+            }
+        }
+        matrix nn = copy_matrix(c);
+        matrix nt = copy_matrix(c);
+        matrix tn = copy_matrix(c);
+        gemm(0, 0, .5, a, b, 2, nn);
+        gemm(0, 1, .5, a, bt, 2, nt);
+        gemm(1, 0, .5, at, b, 2, tn);
+        TEST(same_matrix(nn, gt));
+        TEST(same_matrix(nt, gt));
+        TEST(same_matrix(tn, gt));
+        free_matrix(a); free_matrix(b); free_matrix(at); free_matrix(bt);
+        free_matrix(c); free_matrix(gt);
+        free_matrix(nn); free_matrix(nt); free_matrix(tn);
+    }
+}
+
+void test_dense_layer()
+{
+    // One product small enough to skip packing, one big enough to pack.
+    int sizes[2][3] = {{9, 6, 11}, {203, 67, 129}};
+    ACTIVATION acts[5] = {LINEAR, LOGISTIC, RELU, LRELU, SOFTMAX};
+    int s, n, i, j, k;
+    for(s = 0; s < 2; ++s){
+        int M = sizes[s][0], N = sizes[s][1], K = sizes[s][2];
+        for(n = 0; n < 5; ++n){
+            ACTIVATION a = acts[n];
+            layer l = make_layer(K, N, a);
+            matrix in = random_matrix(M, K, 3);
+            matrix delta = random_matrix(M, N, 1);
+            matrix y = make_matrix(M, N);
+            matrix d = copy_matrix(delta);
+            for(i = 0; i < M; ++i){
+                double max = -INFINITY, sum = 0;
+                for(j = 0; j < N; ++j){
+                    double x = 0;
+                    for(k = 0; k < K; ++k) x += in.data[i][k]*l.w.data[k][j];
+                    if(a == LOGISTIC) x = 1/(1 + exp(-x));
+                    if(a == RELU) x = x > 0 ? x : 0;
+                    if(a == LRELU) x = x > 0 ? x : .1*x;
+                    y.data[i][j] = x;
+                    if(x > max) max = x;
+                }
+                if(a == SOFTMAX){
+                    for(j = 0; j < N; ++j) sum += y.data[i][j] = exp(y.data[i][j] - max);
+                    for(j = 0; j < N; ++j) y.data[i][j] /= sum;
+                }
+                for(j = 0; j < N; ++j){
+                    double x = y.data[i][j];
+                    if(a == LOGISTIC) d.data[i][j] *= x*(1 - x);
+                    if(a == RELU) d.data[i][j] *= x > 0;
+                    if(a == LRELU) d.data[i][j] *= x > 0 ? 1 : .1;
+                }
+            }
+            matrix dw = make_matrix(K, N);
+            matrix dx = make_matrix(M, K);
+            gemm(1, 0, 1, in, d, 0, dw);
+            gemm(0, 1, 1, d, l.w, 0, dx);
+
+            matrix out = forward_layer(&l, in);
+            TEST(same_matrix(out, y));
+            matrix px = backward_layer(&l, delta);
+            TEST(same_matrix(delta, d));
+            TEST(same_matrix(l.dw, dw));
+            TEST(same_matrix(px, dx));
+
+            free_matrix(dw); free_matrix(dx);
+            free_matrix(d); free_matrix(y); free_matrix(delta); free_matrix(in);
+            free_matrix(l.w); free_matrix(l.v); free_matrix(l.dw);
+            free_matrix(l.out); free_matrix(l.dx);
+        }
+    }
+}
+
+void test_train_allocations()
+{
+    data d = {random_matrix(100, 20, 1), make_matrix(100, 4)};
+    int i;
+    for(i = 0; i < d.y.rows; ++i) d.y.data[i][i % 4] = 1;
+    layer l[2] = {make_layer(20, 16, LRELU), make_layer(16, 4, SOFTMAX)};
+    model m = {l, 2};
+
+    // Once the layers have grown, only the per call setup allocates and
+    // more iterations cost nothing.
+    train_model(m, d, 32, 1, .01, .9, .0005);
+    size_t start = matrix_allocations();
+    train_model(m, d, 32, 1, .01, .9, .0005);
+    size_t one = matrix_allocations() - start;
+    start = matrix_allocations();
+    train_model(m, d, 32, 10, .01, .9, .0005);
+    TEST(matrix_allocations() - start == one);
+    TEST(m.layers[1].out.rows == 32 && m.layers[1].batch == 32);
+
+    // Inference on the whole dataset leaves the training workspaces alone.
+    accuracy_model(m, d);
+    TEST(m.layers[1].out.rows == 32 && m.layers[1].batch == 32);
+    TEST(m.layers[0].dx_batch == 32);
+
+    for(i = 0; i < 2; ++i){
+        free_matrix(l[i].w); free_matrix(l[i].v); free_matrix(l[i].dw);
+        free_matrix(l[i].out); free_matrix(l[i].dx);
+    }
+    free_data(d);
+}
+
+void test_forward_model()
+{
+    // More rows than one chunk of inference, and not a multiple of it.
+    matrix X = random_matrix(300, 20, 1);
+    layer l[2] = {make_layer(20, 16, LRELU), make_layer(16, 4, SOFTMAX)};
+    model m = {l, 2};
+    matrix p = forward_model(m, X);
+    matrix y = forward_layer(l + 1, forward_layer(l, X));
+    TEST(same_matrix(p, y));
+    int i;
+    for(i = 0; i < 2; ++i){
+        free_matrix(l[i].w); free_matrix(l[i].v); free_matrix(l[i].dw);
+        free_matrix(l[i].out); free_matrix(l[i].dx);
+    }
+    free_matrix(p);
+    free_matrix(X);
+}
+
+// Train a fresh two layer model from a fixed seed.
+static model seeded_model(data d, int threads)
+{
+    srand(7);
+    layer *l = calloc(2, sizeof(layer));
+    l[0] = make_layer(d.X.cols, 16, LOGISTIC);
+    l[1] = make_layer(16, d.y.cols, SOFTMAX);
+    model m = {l, 2, threads};
+    train_model(m, d, 30, 5, .1, .9, .0005);
+    return m;
+}
+
+static void free_model(model m)
+{
+    int i;
+    for(i = 0; i < m.n; ++i){
+        layer l = m.layers[i];
+        free_matrix(l.w); free_matrix(l.v); free_matrix(l.dw);
+        free_matrix(l.out); free_matrix(l.dx);
+    }
+    free(m.layers);
+}
+
+void test_parallel_training()
+{
+    data d = {random_matrix(90, 12, 1), make_matrix(90, 3)};
+    int i, j, k;
+    for(i = 0; i < d.y.rows; ++i) d.y.data[i][i % 3] = 1;
+    model a = seeded_model(d, 3);
+    model b = seeded_model(d, 3);
+    model c = seeded_model(d, 1);
+    int same = 1;
+    for(k = 0; k < 2; ++k){
+        matrix wa = a.layers[k].w, wb = b.layers[k].w;
+        for(i = 0; i < wa.rows; ++i){
+            for(j = 0; j < wa.cols; ++j) same &= wa.data[i][j] == wb.data[i][j];
+        }
+        // Other thread counts only differ in summation order.
+        TEST(same_matrix(wa, c.layers[k].w));
+    }
+    TEST(same);
+    free_model(a);
+    free_model(b);
+    free_model(c);
+    free_data(d);
+}
+
 void run_tests()
 {
     //test_matrix();
@@ -408,6 +675,13 @@ void run_tests()
     test_sobel();
     test_structure();
     test_cornerness();
+    test_matrix_storage();
+    test_gemm();
+    test_dense_layer();
+    test_train_allocations();
+    test_forward_model();
+    test_parallel_training();
+    test_classification_cache();
     printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
 }
 
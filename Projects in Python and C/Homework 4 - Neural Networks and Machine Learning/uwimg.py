@@ -27,13 +27,17 @@ class POINT(Structure):
 class DESCRIPTOR(Structure):
     _fields_ = [("p", POINT),
                 ("n", c_int),
+                ("kind", c_ubyte),
+                ("shared", c_ubyte),
                 ("data", POINTER(c_float))]
 
 class MATRIX(Structure):
     _fields_ = [("rows", c_int),
                 ("cols", c_int),
                 ("data", POINTER(POINTER(c_double))),
-                ("shallow", c_int)]
+                ("shallow", c_int),
+                ("stride", c_int),
+                ("vals", POINTER(c_double))]
 
 class DATA(Structure):
     _fields_ = [("X", MATRIX),
@@ -45,11 +49,15 @@ class LAYER(Structure):
                 ("w", MATRIX),
                 ("v", MATRIX),
                 ("out", MATRIX),
-                ("activation", c_int)]
+                ("activation", c_int),
+                ("dx", MATRIX),
+                ("batch", c_int),
+                ("dx_batch", c_int)]
 
 class MODEL(Structure):
     _fields_ = [("layers", POINTER(LAYER)),
-                ("n", c_int)]
+                ("n", c_int),
+                ("threads", c_int)]
 
 
 (LINEAR, LOGISTIC, RELU, LRELU, SOFTMAX) = range(5)
@@ -239,6 +247,10 @@ forward_model = lib.forward_model
 forward_model.argtypes = [MODEL, MATRIX]
 forward_model.restype = MATRIX
 
+free_matrix = lib.free_matrix
+free_matrix.argtypes = [MATRIX]
+free_matrix.restype = None
+
 load_classification_data = lib.load_classification_data
 load_classification_data.argtypes = [c_char_p, c_char_p, c_int]
 load_classification_data.restype = DATA
@@ -247,9 +259,10 @@ make_layer = lib.make_layer
 make_layer.argtypes = [c_int, c_int, c_int]
 make_layer.restype = LAYER
 
-def make_model(layers):
+def make_model(layers, threads=1):
     m = MODEL()
     m.n = len(layers)
+    m.threads = threads
     m.layers = (LAYER*m.n) (*layers)
     return m
 